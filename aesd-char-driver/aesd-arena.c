@@ -0,0 +1,311 @@
+/**
+ * @file aesd-arena.c
+ * @brief Contiguous byte arena holding the command history of the aesdchar driver
+ *
+ * Each write is copied once, straight into the arena slot where the command
+ * will live, and the circular buffer entries point into the arena. Growing a
+ * pending command never reallocates, and evicting a command frees nothing:
+ * its bytes are simply reused once the ring comes around.
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/rcupdate.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+/* Always vmalloc, so the pages can be mapped into user space; zeroed, as unused bytes are visible there */
+#define aesd_arena_alloc(size) vzalloc(size)
+#define aesd_arena_dealloc(ptr) vfree(ptr)
+/* Lockless readers may still be copying from storage replaced by a grow */
+#define aesd_arena_retire(ptr) do { synchronize_rcu(); vfree(ptr); } while (0)
+#else
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#define aesd_arena_alloc(size) malloc(size)
+#define aesd_arena_dealloc(ptr) free(ptr)
+#define aesd_arena_retire(ptr) free(ptr)
+#endif
+
+#include "aesd-arena.h"
+
+/**
+* Initializes @param arena to an empty arena that is allocated with @param initial_size bytes on
+* first use and doubles as needed up to @param max_size bytes.
+*/
+void aesd_arena_init(struct aesd_arena *arena, size_t initial_size, size_t max_size)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->initial_size = initial_size != 0 ? initial_size : 1;
+    arena->max_size = max_size > arena->initial_size ? max_size : arena->initial_size;
+}
+
+/**
+* Initializes @param arena to use @param size bytes of caller owned @param storage, for instance
+* shared memory. The arena never grows and aesd_arena_free() leaves the storage alone.
+*/
+void aesd_arena_init_fixed(struct aesd_arena *arena, char *storage, size_t size)
+{
+    aesd_arena_init(arena, size, size);
+    arena->data = storage;
+    arena->size = size;
+    arena->fixed = true;
+}
+
+/**
+* Frees the storage of @param arena. Entries pointing into it must no longer be used.
+*/
+void aesd_arena_free(struct aesd_arena *arena)
+{
+    if (!arena->fixed) {
+        aesd_arena_dealloc(arena->data);
+    }
+    arena->data = NULL;
+    arena->size = 0;
+    arena->pending_start = 0;
+    arena->pending_len = 0;
+}
+
+/**
+* @return the arena offset of the oldest byte still in use: the oldest entry of @param buffer, or
+* the pending command if the buffer is empty
+*/
+static size_t aesd_arena_tail(const struct aesd_arena *arena, struct aesd_circular_buffer *buffer)
+{
+    struct aesd_buffer_entry *oldest = aesd_circular_buffer_get_entry(buffer, 0, NULL);
+
+    return oldest != NULL ? (size_t)(oldest->buffptr - arena->data) : arena->pending_start;
+}
+
+/**
+* @return the size to grow @param arena to so that it holds at least @param min_size bytes
+*/
+static size_t aesd_arena_grow_size(const struct aesd_arena *arena, size_t min_size)
+{
+    size_t new_size = arena->initial_size;
+
+    /* Always at least double, so running out of room repeatedly stays amortized O(1) per byte */
+    while ((new_size < min_size || new_size <= arena->size) && new_size <= arena->max_size / 2) {
+        new_size *= 2;
+    }
+    if (new_size < min_size || new_size > arena->max_size) {
+        new_size = arena->max_size;
+    }
+    return new_size;
+}
+
+/**
+* Checks whether @param len more bytes of the pending command fit in @param arena without growing
+* or evicting. @param compact_rtn is set if they only fit once the pending command moves to the
+* start of the arena.
+*/
+static bool aesd_arena_fits(const struct aesd_arena *arena, struct aesd_circular_buffer *buffer, size_t len,
+            bool *compact_rtn)
+{
+    size_t need = arena->pending_len + len;
+    size_t head;
+    size_t tail;
+
+    *compact_rtn = false;
+    if (arena->data == NULL) {
+        return false;
+    }
+    head = arena->pending_start + arena->pending_len;
+    tail = aesd_arena_tail(arena, buffer);
+    /* Entries are never empty, so the oldest one only starts at or after the pending command
+     * once the newer entries have restarted at the front of the arena */
+    if (aesd_circular_buffer_entry_count(buffer) != 0 && tail >= arena->pending_start) {
+        return tail - head >= len;
+    }
+    if (arena->size - head >= len) {
+        return true;
+    }
+    *compact_rtn = (aesd_circular_buffer_entry_count(buffer) != 0 ? tail : arena->size) >= need;
+    return *compact_rtn;
+}
+
+/**
+* Copies the entries of @param buffer oldest first followed by the pending command of @param arena
+* to the start of @param data, leaving the arena itself untouched
+*/
+static void aesd_arena_copy_to(const struct aesd_arena *arena, struct aesd_circular_buffer *buffer, char *data)
+{
+    struct aesd_buffer_entry *entry;
+    size_t pos = 0;
+    size_t index;
+
+    for (index = 0; (entry = aesd_circular_buffer_get_entry(buffer, index, NULL)) != NULL; index++) {
+        memcpy(data + pos, entry->buffptr, entry->size);
+        pos += entry->size;
+    }
+    if (arena->pending_len != 0) {
+        memcpy(data + pos, arena->data + arena->pending_start, arena->pending_len);
+    }
+}
+
+/**
+* If reserving @param len bytes in @param arena would have to grow it, allocates the new storage
+* and copies the entries of @param buffer and the pending command into it, setting @param data_rtn
+* and @param size_rtn for aesd_arena_finish_grow(); otherwise @param data_rtn is set to NULL.
+* Only reads the arena, so it can run while readers use it; nothing may change the arena until
+* aesd_arena_finish_grow(). This is the part of a grow that allocates and copies.
+* @return 0 on success or -ENOMEM
+*/
+int aesd_arena_prepare_grow(struct aesd_arena *arena, struct aesd_circular_buffer *buffer, size_t len,
+            char **data_rtn, size_t *size_rtn)
+{
+    size_t need = arena->pending_len + len;
+    bool compact;
+    char *data;
+    size_t size;
+
+    *data_rtn = NULL;
+    /* aesd_arena_reserve() finds room, evicts or fails without growing */
+    if (need < len || need > arena->max_size || arena->size >= arena->max_size ||
+        aesd_arena_fits(arena, buffer, len, &compact)) {
+        return 0;
+    }
+
+    size = aesd_arena_grow_size(arena, aesd_circular_buffer_total_size(buffer) + need);
+    data = aesd_arena_alloc(size);
+    if (data == NULL) {
+        return -ENOMEM;
+    }
+    aesd_arena_copy_to(arena, buffer, data);
+    *data_rtn = data;
+    *size_rtn = size;
+    return 0;
+}
+
+/**
+* Switches @param arena to the storage @param data of @param size bytes filled in by
+* aesd_arena_prepare_grow(), pointing the entries of @param buffer at their new location.
+* Does nothing if @param data is NULL.
+* @return the old storage, to pass to aesd_arena_release_storage() once readers no longer need it
+*/
+char *aesd_arena_finish_grow(struct aesd_arena *arena, struct aesd_circular_buffer *buffer, char *data,
+            size_t size)
+{
+    struct aesd_buffer_entry *entry;
+    char *old = arena->data;
+    size_t pos = 0;
+    size_t index;
+
+    if (data == NULL) {
+        return NULL;
+    }
+    for (index = 0; (entry = aesd_circular_buffer_get_entry(buffer, index, NULL)) != NULL; index++) {
+        entry->buffptr = data + pos;
+        pos += entry->size;
+    }
+    arena->data = data;
+    arena->size = size;
+    arena->pending_start = pos;
+    return old;
+}
+
+/**
+* Frees storage replaced by aesd_arena_finish_grow(). In the kernel this waits for an RCU grace
+* period first, so readers that looked up an entry before the move can finish copying from it;
+* it may sleep.
+*/
+void aesd_arena_release_storage(char *data)
+{
+    if (data != NULL) {
+        aesd_arena_retire(data);
+    }
+}
+
+/**
+* Reallocates @param arena with room for at least @param len more pending bytes, moving the
+* entries of @param buffer oldest first followed by the pending command to the start of the
+* new storage.
+* @return 0 on success or -ENOMEM
+*/
+static int aesd_arena_grow(struct aesd_arena *arena, struct aesd_circular_buffer *buffer, size_t len)
+{
+    size_t size = aesd_arena_grow_size(arena, aesd_circular_buffer_total_size(buffer) + arena->pending_len + len);
+    char *data = aesd_arena_alloc(size);
+
+    if (data == NULL) {
+        return -ENOMEM;
+    }
+    aesd_arena_copy_to(arena, buffer, data);
+    aesd_arena_release_storage(aesd_arena_finish_grow(arena, buffer, data, size));
+    return 0;
+}
+
+/**
+* Makes room for @param len more bytes of the pending command in @param arena. The room always
+* directly follows the pending bytes, so the command stays contiguous; the pending command may be
+* moved to the start of the arena to get there. The arena grows while below its maximum size,
+* after which the oldest entries of @param buffer are evicted to free their bytes. A caller that
+* must not allocate here runs aesd_arena_prepare_grow() and aesd_arena_finish_grow() first.
+* On success, @param dest_rtn is set to where the caller should copy the new bytes; call
+* aesd_arena_append() for the bytes actually used.
+* Any necessary locking must be handled by the caller
+* @return 0 on success, -EFBIG if the command cannot fit within max_size or -ENOMEM
+*/
+int aesd_arena_reserve(struct aesd_arena *arena, struct aesd_circular_buffer *buffer, size_t len,
+            char **dest_rtn)
+{
+    size_t need = arena->pending_len + len;
+    bool compact;
+    int result;
+
+    if (need < len || need > arena->max_size) {
+        return -EFBIG;
+    }
+
+    while (!aesd_arena_fits(arena, buffer, len, &compact)) {
+        if (arena->size < arena->max_size) {
+            result = aesd_arena_grow(arena, buffer, len);
+            if (result) {
+                return result;
+            }
+        } else if (aesd_circular_buffer_entry_count(buffer) != 0) {
+            aesd_circular_buffer_remove_oldest(buffer, NULL);
+        } else {
+            return -EFBIG;
+        }
+    }
+    if (compact) {
+        memmove(arena->data, arena->data + arena->pending_start, arena->pending_len);
+        arena->pending_start = 0;
+    }
+
+    *dest_rtn = arena->data + arena->pending_start + arena->pending_len;
+    return 0;
+}
+
+/**
+* Extends the pending command of @param arena by @param len bytes previously reserved with
+* aesd_arena_reserve() and filled by the caller.
+*/
+void aesd_arena_append(struct aesd_arena *arena, size_t len)
+{
+    arena->pending_len += len;
+}
+
+/**
+* Completes the first @param len bytes of the pending command of @param arena as a command,
+* describing it in @param entry_rtn so it can be added to the circular buffer. The rest of the
+* pending bytes stay pending, so one reservation can be split into several commands.
+*/
+void aesd_arena_commit_part(struct aesd_arena *arena, size_t len, struct aesd_buffer_entry *entry_rtn)
+{
+    entry_rtn->buffptr = arena->data + arena->pending_start;
+    entry_rtn->size = len;
+    arena->pending_start += len;
+    arena->pending_len -= len;
+}
+
+/**
+* Completes the pending command of @param arena, describing it in @param entry_rtn so it can be
+* added to the circular buffer. The next command starts right after it.
+*/
+void aesd_arena_commit(struct aesd_arena *arena, struct aesd_buffer_entry *entry_rtn)
+{
+    aesd_arena_commit_part(arena, arena->pending_len, entry_rtn);
+}
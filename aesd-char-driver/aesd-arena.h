@@ -0,0 +1,87 @@
+/*
+ * aesd-arena.h
+ *
+ * Contiguous byte arena backing the aesdchar command history
+ */
+
+#ifndef AESD_ARENA_H
+#define AESD_ARENA_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h> // size_t
+#include <stdint.h>
+#include <stdbool.h>
+#endif
+
+#include "aesd-circular-buffer.h"
+
+/**
+ * Default initial and maximum arena sizes
+ */
+#define AESD_ARENA_DEFAULT_SIZE     (16 * 1024)
+#define AESD_ARENA_DEFAULT_MAX_SIZE (64 * 1024 * 1024)
+
+/**
+ * Commands are stored back to back in one allocation and used as a ring:
+ * the bytes of every entry in the circular buffer, oldest first, followed by
+ * the pending (not yet newline terminated) command at pending_start. A command
+ * never wraps, so each entry stays a single contiguous buffptr. When the pending
+ * command reaches the end of the arena it restarts at offset 0 once the oldest
+ * entries have left enough room there.
+ * Any necessary locking must be performed by the caller.
+ */
+struct aesd_arena
+{
+    /**
+     * Arena storage, allocated on first use
+     */
+    char *data;
+    /**
+     * Current size of data
+     */
+    size_t size;
+    /**
+     * Size of the first allocation; the arena doubles from there
+     */
+    size_t initial_size;
+    /**
+     * The arena never grows beyond this; the oldest entries are evicted instead
+     */
+    size_t max_size;
+    /**
+     * Offset and length of the pending command
+     */
+    size_t pending_start;
+    size_t pending_len;
+    /**
+     * Storage is owned by the caller, see aesd_arena_init_fixed()
+     */
+    bool fixed;
+};
+
+extern void aesd_arena_init(struct aesd_arena *arena, size_t initial_size, size_t max_size);
+
+extern void aesd_arena_init_fixed(struct aesd_arena *arena, char *storage, size_t size);
+
+extern void aesd_arena_free(struct aesd_arena *arena);
+
+extern int aesd_arena_prepare_grow(struct aesd_arena *arena, struct aesd_circular_buffer *buffer, size_t len,
+            char **data_rtn, size_t *size_rtn);
+
+extern char *aesd_arena_finish_grow(struct aesd_arena *arena, struct aesd_circular_buffer *buffer, char *data,
+            size_t size);
+
+extern void aesd_arena_release_storage(char *data);
+
+extern int aesd_arena_reserve(struct aesd_arena *arena, struct aesd_circular_buffer *buffer, size_t len,
+            char **dest_rtn);
+
+extern void aesd_arena_append(struct aesd_arena *arena, size_t len);
+
+extern void aesd_arena_commit_part(struct aesd_arena *arena, size_t len, struct aesd_buffer_entry *entry_rtn);
+
+extern void aesd_arena_commit(struct aesd_arena *arena, struct aesd_buffer_entry *entry_rtn);
+
+#endif /* AESD_ARENA_H */
@@ -9,13 +9,59 @@
  */
 
 #ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/slab.h>
 #include <linux/string.h>
+#define aesd_cb_calloc(n, size) kcalloc(n, size, GFP_KERNEL)
+#define aesd_cb_free(ptr) kfree(ptr)
 #else
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#define aesd_cb_calloc(n, size) calloc(n, size)
+#define aesd_cb_free(ptr) free(ptr)
 #endif
 
 #include "aesd-circular-buffer.h"
 
+/**
+* Entry counts up to this are located by counting the entry starts at or before the offset instead
+* of by binary search. The count has no data dependent branches, so it beats a search whose exit
+* mispredicts, and it stays within the embedded slots.
+*/
+#define AESD_CB_LINEAR_SCAN_MAX AESD_CIRCULAR_BUFFER_INLINE_SLOTS
+
+/**
+* @return the number of @param start values in [@param begin, @param end) that lie at most
+* @param char_offset bytes past @param first_start
+*/
+static uint32_t aesd_cb_count_run(const size_t *start, uint32_t begin, uint32_t end, size_t first_start,
+            size_t char_offset)
+{
+    uint32_t found = 0;
+    uint32_t i;
+
+    for (i = begin; i < end; i++) {
+        found += start[i] - first_start <= char_offset;
+    }
+    return found;
+}
+
+/**
+* @return the number of entries in @param buffer starting at or before @param char_offset,
+* the index of the entry holding it plus one. Entry starts only grow from the oldest entry on,
+* so this is a count over the one or two contiguous runs of slots in use.
+*/
+static uint32_t aesd_cb_count_starts(const struct aesd_circular_buffer *buffer, size_t first_start,
+            size_t char_offset)
+{
+    uint32_t end = buffer->out_offs + buffer->count;
+    uint32_t run_end = end < buffer->slots ? end : buffer->slots;
+
+    return aesd_cb_count_run(buffer->entry_start, buffer->out_offs, run_end, first_start, char_offset) +
+           aesd_cb_count_run(buffer->entry_start, 0, end - run_end, first_start, char_offset);
+}
+
 /**
  * @param buffer the buffer to search for corresponding offset.  Any necessary locking must be performed by caller.
  * @param char_offset the position to search for in the buffer list, describing the zero referenced
@@ -29,58 +75,232 @@
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
-    /**
-    * implement per description
-    */
-    size_t cumulative_offset = 0;
-    uint8_t index;
-    uint8_t count = 0;
-    uint8_t max_entries = buffer->full ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : buffer->in_offs;
-
-    index = buffer->out_offs;
-
-    while (count < max_entries) {
-        struct aesd_buffer_entry *entry = &buffer->entry[index];
-        if (cumulative_offset + entry->size > char_offset) {
-            *entry_offset_byte_rtn = char_offset - cumulative_offset;
-            return entry;
+    uint32_t mask = buffer->slots - 1;
+    uint32_t low = 0;
+    uint32_t high = buffer->count;
+    size_t first_start;
+    uint32_t index;
+
+    if (buffer->count == 0 || char_offset >= aesd_circular_buffer_total_size(buffer)) {
+        return NULL;
+    }
+
+    /*
+     * Find the last entry starting at or before char_offset. Start offsets are
+     * compared relative to the oldest entry so the free-running counters may wrap.
+     */
+    first_start = buffer->entry_start[buffer->out_offs];
+    if (buffer->count <= AESD_CB_LINEAR_SCAN_MAX) {
+        low = aesd_cb_count_starts(buffer, first_start, char_offset) - 1;
+    } else {
+        while (high - low > 1) {
+            uint32_t mid = low + (high - low) / 2;
+            index = (buffer->out_offs + mid) & mask;
+            if (buffer->entry_start[index] - first_start <= char_offset) {
+                low = mid;
+            } else {
+                high = mid;
+            }
         }
-        cumulative_offset += entry->size;
-        index = (index + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        count++;
     }
 
-    return NULL;
+    index = (buffer->out_offs + low) & mask;
+    *entry_offset_byte_rtn = char_offset - (buffer->entry_start[index] - first_start);
+    return &buffer->entry[index];
+}
+
+/**
+* Removes the oldest entry of @param buffer, copying it to @param removed_rtn if not NULL.
+* The caller must ensure the buffer is not empty.
+* Any necessary locking must be handled by the caller
+*/
+void aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *removed_rtn)
+{
+    struct aesd_buffer_entry *oldest = &buffer->entry[buffer->out_offs];
+
+    if (removed_rtn != NULL) {
+        *removed_rtn = *oldest;
+    }
+    oldest->buffptr = NULL;
+    oldest->size = 0;
+    buffer->out_offs = (buffer->out_offs + 1) & (buffer->slots - 1);
+    buffer->count--;
+    buffer->full = false;
+}
+
+/**
+* Checks whether adding an entry of @param add_size bytes to @param buffer requires evicting the
+* oldest entry, either because capacity entries are stored or because the byte budget would be
+* exceeded. If so, removes the oldest entry, stores it in @param evicted_rtn and returns true so
+* the caller can release its memory; call repeatedly until it returns false, then add the entry.
+* Any necessary locking must be handled by the caller
+*/
+bool aesd_circular_buffer_evict_for(struct aesd_circular_buffer *buffer, size_t add_size,
+            struct aesd_buffer_entry *evicted_rtn)
+{
+    if (buffer->count == 0) {
+        return false;
+    }
+    if (buffer->count < buffer->capacity &&
+        (buffer->byte_budget == 0 ||
+         aesd_circular_buffer_total_size(buffer) + add_size <= buffer->byte_budget)) {
+        return false;
+    }
+
+    aesd_circular_buffer_remove_oldest(buffer, evicted_rtn);
+    return true;
 }
 
 /**
 * Adds entry @param add_entry to @param buffer in the location specified in buffer->in_offs.
 * If the buffer was already full, overwrites the oldest entry and advances buffer->out_offs to the
-* new start location.
+* new start location. Entries over the byte budget are dropped the same way; callers owning the
+* entry memory should release them first with aesd_circular_buffer_evict_for().
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
 */
 void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
-    /**
-    * implement per description
-    */
-    if (buffer->full) {
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    while (aesd_circular_buffer_evict_for(buffer, add_entry->size, NULL)) {
+        /* Overwrite semantics: the caller keeps ownership of the dropped memory */
     }
 
     buffer->entry[buffer->in_offs] = *add_entry;
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->entry_start[buffer->in_offs] = buffer->end_offset;
+    buffer->end_offset += add_entry->size;
+    buffer->in_offs = (buffer->in_offs + 1) & (buffer->slots - 1);
+    buffer->count++;
 
-    if (buffer->in_offs == buffer->out_offs) {
+    if (buffer->count == buffer->capacity) {
         buffer->full = true;
     }
 }
 
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
+* holding up to AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries in embedded storage
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    buffer->entry = buffer->entry_inline;
+    buffer->entry_start = buffer->entry_start_inline;
+    buffer->slots = AESD_CIRCULAR_BUFFER_INLINE_SLOTS;
+    buffer->capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+* Initializes @param buffer to hold up to @param capacity entries and, if @param byte_budget is
+* nonzero, at most that many bytes. Slot storage beyond the embedded slots is allocated and must
+* be freed with aesd_circular_buffer_release().
+* @return 0 on success, -EINVAL for an out of range capacity, -ENOMEM if allocation fails
+*/
+int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, uint32_t capacity,
+            size_t byte_budget)
+{
+    uint32_t slots = AESD_CIRCULAR_BUFFER_INLINE_SLOTS;
+
+    if (capacity == 0 || capacity > AESD_CIRCULAR_BUFFER_MAX_ENTRIES) {
+        return -EINVAL;
+    }
+
+    aesd_circular_buffer_init(buffer);
+    buffer->capacity = capacity;
+    buffer->byte_budget = byte_budget;
+    if (capacity <= slots) {
+        return 0;
+    }
+
+    /* Round up to a power of two so slot indexes wrap with a mask instead of a division */
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+    buffer->entry = aesd_cb_calloc(slots, sizeof(*buffer->entry));
+    buffer->entry_start = aesd_cb_calloc(slots, sizeof(*buffer->entry_start));
+    if (buffer->entry == NULL || buffer->entry_start == NULL) {
+        aesd_circular_buffer_release(buffer);
+        return -ENOMEM;
+    }
+    buffer->slots = slots;
+    return 0;
+}
+
+/**
+* Frees slot storage allocated by aesd_circular_buffer_init_capacity() and leaves @param buffer
+* empty with the default capacity. Memory referenced by the entries is not freed.
+*/
+void aesd_circular_buffer_release(struct aesd_circular_buffer *buffer)
+{
+    if (buffer->entry != buffer->entry_inline) {
+        aesd_cb_free(buffer->entry);
+    }
+    if (buffer->entry_start != buffer->entry_start_inline) {
+        aesd_cb_free(buffer->entry_start);
+    }
+    aesd_circular_buffer_init(buffer);
+}
+
+/**
+* @return the number of entries currently stored in @param buffer
+*/
+uint32_t aesd_circular_buffer_entry_count(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->count;
+}
+
+/**
+* @return the number of bytes stored in @param buffer, in constant time.
+* Derived from the start offsets, so it stays correct when the caller clears
+* the size of an entry that is about to be overwritten.
+*/
+size_t aesd_circular_buffer_total_size(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->count == 0) {
+        return 0;
+    }
+    return buffer->end_offset - buffer->entry_start[buffer->out_offs];
+}
+
+/**
+* @return the free-running offset of the oldest byte stored in @param buffer. Unlike the positions
+* used by aesd_circular_buffer_find_entry_offset_for_fpos(), stream offsets do not shift when old
+* entries are evicted; subtract this value to convert one into a position.
+*/
+size_t aesd_circular_buffer_stream_start(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->count == 0) {
+        return buffer->end_offset;
+    }
+    return buffer->entry_start[buffer->out_offs];
+}
+
+/**
+* @return the free-running offset one past the newest byte stored in @param buffer
+*/
+size_t aesd_circular_buffer_stream_end(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->end_offset;
+}
+
+/**
+* @param entry_index the zero referenced command index, 0 being the oldest entry
+* @param start_offset_rtn if not NULL, receives the byte offset of the entry's first
+*      character within the concatenation of all entries
+* @return the entry, or NULL if @param entry_index is not stored in @param buffer
+*/
+struct aesd_buffer_entry *aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+            size_t entry_index, size_t *start_offset_rtn)
+{
+    uint32_t index;
+
+    if (entry_index >= buffer->count) {
+        return NULL;
+    }
+
+    index = (buffer->out_offs + entry_index) & (buffer->slots - 1);
+    if (start_offset_rtn != NULL) {
+        *start_offset_rtn = buffer->entry_start[index] - buffer->entry_start[buffer->out_offs];
+    }
+    return &buffer->entry[index];
 }
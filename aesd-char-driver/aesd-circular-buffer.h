@@ -16,8 +16,22 @@
 #include <stdbool.h>
 #endif
 
+/**
+ * Default history depth, used by aesd_circular_buffer_init()
+ */
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
 
+/**
+ * Slots embedded in the buffer for the default depth; a power of two no
+ * smaller than AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+ */
+#define AESD_CIRCULAR_BUFFER_INLINE_SLOTS 16
+
+/**
+ * Largest history depth accepted by aesd_circular_buffer_init_capacity()
+ */
+#define AESD_CIRCULAR_BUFFER_MAX_ENTRIES (1u << 24)
+
 struct aesd_buffer_entry
 {
     /**
@@ -33,22 +47,53 @@ struct aesd_buffer_entry
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * An array of pointers to memory allocated for the most recent write operations.
+     * Points at entry_inline for the default depth, otherwise at an allocated array.
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_buffer_entry *entry;
+    /**
+     * Logical start offset of each entry: the number of bytes added to the
+     * buffer before it. Free-running, so evicting an entry never shifts the others.
+     * Kept apart from entry[] so lookups scan densely packed offsets without loading
+     * any entry pointers.
+     */
+    size_t *entry_start;
+    /**
+     * Number of slots in entry[], a power of two so indexes wrap with a mask
+     */
+    uint32_t slots;
+    /**
+     * Maximum number of entries kept, no larger than slots
+     */
+    uint32_t capacity;
+    /**
+     * If nonzero, the oldest entries are evicted until the stored bytes fit
+     * within this budget (the newest entry is always kept)
+     */
+    size_t byte_budget;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
      */
-    uint8_t in_offs;
+    uint32_t in_offs;
     /**
      * The first location in the entry structure to read from
      */
-    uint8_t out_offs;
+    uint32_t out_offs;
+    /**
+     * Number of entries currently stored
+     */
+    uint32_t count;
     /**
-     * set to true when the buffer entry structure is full
+     * set to true when the buffer holds capacity entries
      */
     bool full;
+    /**
+     * Logical offset one past the end of the newest entry
+     */
+    size_t end_offset;
+    struct aesd_buffer_entry entry_inline[AESD_CIRCULAR_BUFFER_INLINE_SLOTS];
+    size_t entry_start_inline[AESD_CIRCULAR_BUFFER_INLINE_SLOTS];
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
@@ -56,16 +101,38 @@ extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos
 
 extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern void aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *removed_rtn);
+
+extern bool aesd_circular_buffer_evict_for(struct aesd_circular_buffer *buffer, size_t add_size,
+            struct aesd_buffer_entry *evicted_rtn);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, uint32_t capacity,
+            size_t byte_budget);
+
+extern void aesd_circular_buffer_release(struct aesd_circular_buffer *buffer);
+
+extern uint32_t aesd_circular_buffer_entry_count(const struct aesd_circular_buffer *buffer);
+
+extern size_t aesd_circular_buffer_total_size(const struct aesd_circular_buffer *buffer);
+
+extern size_t aesd_circular_buffer_stream_start(const struct aesd_circular_buffer *buffer);
+
+extern size_t aesd_circular_buffer_stream_end(const struct aesd_circular_buffer *buffer);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_get_entry(struct aesd_circular_buffer *buffer,
+            size_t entry_index, size_t *start_offset_rtn);
+
 /**
- * Create a for loop to iterate over each member of the circular buffer.
+ * Create a for loop to iterate over each slot of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is a uint32_t stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * uint32_t index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -74,7 +141,7 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
     for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index<(buffer)->slots; \
             index++, entryptr=&((buffer)->entry[index]))
 
 
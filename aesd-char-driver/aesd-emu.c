@@ -0,0 +1,236 @@
+/**
+ * @file aesd-emu.c
+ * @brief User space emulation of an aesdchar device backed by shared memory
+ *
+ * The file operations mirror main.c, with a pthread mutex in place of
+ * dev->lock. Functions return negative errno values like the driver does.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "aesd-emu.h"
+
+/**
+ * Mark the start of an update in the shared header, like aesd_update_begin() in main.c
+ */
+static void aesd_emu_update_begin(struct aesd_history *history)
+{
+    struct aesd_emu *emu = (struct aesd_emu *)((char *)history - offsetof(struct aesd_emu, history));
+
+    __atomic_store_n(&emu->header->generation, emu->header->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void aesd_emu_update_end(struct aesd_history *history, uint32_t added)
+{
+    struct aesd_emu *emu = (struct aesd_emu *)((char *)history - offsetof(struct aesd_emu, history));
+
+    aesd_history_sync_header(history, emu->header, &emu->synced_data, added);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&emu->header->generation, emu->header->generation + 1, __ATOMIC_RELAXED);
+}
+
+static const struct aesd_history_ops aesd_emu_ops = {
+    .update_begin = aesd_emu_update_begin,
+    .update_end = aesd_emu_update_end,
+};
+
+/**
+ * Copy from the plain buffer source
+ */
+static int aesd_emu_copy(void *source, char *dest, size_t len)
+{
+    memcpy(dest, source, len);
+    return 0;
+}
+
+/**
+ * Create the shared memory file at path, replacing any previous one, and start an empty
+ * history of entries commands in data_size bytes of it
+ * Returns 0 on success or a negative errno
+ */
+int aesd_emu_open(struct aesd_emu *emu, const char *path, unsigned int entries, size_t data_size)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t header_size;
+    void *map;
+    int result;
+    int fd;
+
+    memset(emu, 0, sizeof(*emu));
+    result = aesd_history_init(&emu->history, entries, 0, data_size, data_size, &aesd_emu_ops);
+    if (result)
+        return result;
+    header_size = (aesd_history_header_size(&emu->history) + page_size - 1) & ~(page_size - 1);
+    data_size = (data_size + page_size - 1) & ~(page_size - 1);
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        result = -errno;
+        aesd_history_free(&emu->history);
+        return result;
+    }
+    if (ftruncate(fd, header_size + data_size) < 0) {
+        result = -errno;
+        close(fd);
+        aesd_history_free(&emu->history);
+        return result;
+    }
+    map = mmap(NULL, header_size + data_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    result = map == MAP_FAILED ? -errno : 0;
+    // The mapping keeps the file alive
+    close(fd);
+    if (result) {
+        aesd_history_free(&emu->history);
+        return result;
+    }
+
+    emu->header = map;
+    emu->map_size = header_size + data_size;
+    aesd_arena_init_fixed(&emu->history.arena, (char *)map + header_size, data_size);
+    aesd_history_init_header(&emu->history, emu->header, header_size, &emu->synced_data);
+    pthread_mutex_init(&emu->lock, NULL);
+    return 0;
+}
+
+/**
+ * Unmap an emulated device; the shared memory file is left in place for other readers
+ */
+void aesd_emu_close(struct aesd_emu *emu)
+{
+    aesd_history_free(&emu->history);
+    munmap(emu->header, emu->map_size);
+    pthread_mutex_destroy(&emu->lock);
+}
+
+void aesd_emu_file_open(struct aesd_emu_file *file, struct aesd_emu *emu)
+{
+    memset(file, 0, sizeof(*file));
+    file->emu = emu;
+}
+
+/**
+ * Close file, leaving an unterminated write for the next writer as aesd_release() does
+ */
+void aesd_emu_file_release(struct aesd_emu_file *file)
+{
+    struct aesd_emu *emu = file->emu;
+
+    if (file->partial.size != 0) {
+        pthread_mutex_lock(&emu->lock);
+        aesd_history_release_partial(&emu->history, &file->partial);
+        pthread_mutex_unlock(&emu->lock);
+    }
+    aesd_partial_free(&file->partial);
+}
+
+ssize_t aesd_emu_file_write(struct aesd_emu_file *file, const void *buf, size_t count)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = count };
+
+    return aesd_emu_file_writev(file, &iov, 1);
+}
+
+/**
+ * Store each iovec like its own write(), all under one lock acquisition, as aesd_write_iter() does
+ * Returns the bytes stored or a negative errno if none were
+ */
+ssize_t aesd_emu_file_writev(struct aesd_emu_file *file, const struct iovec *iov, int iovcnt)
+{
+    struct aesd_emu *emu = file->emu;
+    ssize_t retval = 0;
+    ssize_t written;
+
+    pthread_mutex_lock(&emu->lock);
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        written = aesd_history_write(&emu->history, &file->partial, aesd_emu_copy, iov[i].iov_base,
+                    iov[i].iov_len);
+        if (written < 0) {
+            if (retval == 0) {
+                retval = written;
+            }
+            break;
+        }
+        retval += written;
+        if ((size_t)written < iov[i].iov_len) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&emu->lock);
+    return retval;
+}
+
+/**
+ * Copy up to count bytes of the history at pos into buf
+ * Returns the number of bytes copied, 0 at the end of the stored data
+ */
+ssize_t aesd_emu_file_pread(struct aesd_emu_file *file, void *buf, size_t count, long long pos)
+{
+    struct aesd_emu *emu = file->emu;
+    const char *src = NULL;
+    size_t retval = 0;
+    size_t copied;
+
+    if (pos < 0) {
+        return -EINVAL;
+    }
+    pthread_mutex_lock(&emu->lock);
+    while (retval < count &&
+           (copied = aesd_history_locate(&emu->history, pos + retval, count - retval, &src)) != 0) {
+        memcpy((char *)buf + retval, src, copied);
+        retval += copied;
+    }
+    pthread_mutex_unlock(&emu->lock);
+    return retval;
+}
+
+ssize_t aesd_emu_file_read(struct aesd_emu_file *file, void *buf, size_t count)
+{
+    ssize_t retval = aesd_emu_file_pread(file, buf, count, file->pos);
+
+    if (retval > 0) {
+        file->pos += retval;
+    }
+    return retval;
+}
+
+long long aesd_emu_file_llseek(struct aesd_emu_file *file, long long offset, int whence)
+{
+    struct aesd_emu *emu = file->emu;
+    long long pos;
+
+    pthread_mutex_lock(&emu->lock);
+    pos = aesd_history_seek(&emu->history, file->pos, offset, whence);
+    pthread_mutex_unlock(&emu->lock);
+    if (pos >= 0) {
+        file->pos = pos;
+    }
+    return pos;
+}
+
+/**
+ * The equivalent of AESDCHAR_IOCSEEKTO
+ * Returns 0 on success or -EINVAL
+ */
+int aesd_emu_file_seekto(struct aesd_emu_file *file, uint32_t write_cmd, uint32_t write_cmd_offset)
+{
+    struct aesd_emu *emu = file->emu;
+    long long pos;
+
+    pthread_mutex_lock(&emu->lock);
+    pos = aesd_history_seekto(&emu->history, write_cmd, write_cmd_offset);
+    pthread_mutex_unlock(&emu->lock);
+    if (pos < 0) {
+        return (int)pos;
+    }
+    file->pos = pos;
+    return 0;
+}
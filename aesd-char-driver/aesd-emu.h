@@ -0,0 +1,73 @@
+/*
+ * aesd-emu.h
+ *
+ * User space emulation of an aesdchar device on top of the driver's own
+ * history code (aesd-history.c), for profiling the driver logic without a
+ * kernel and as an in-process storage backend.
+ *
+ * The history lives in a shared memory file laid out exactly like mmap() of
+ * the real device (see aesd_mmap.h): the header at offset 0, the command
+ * storage at header->data_offset. Other processes can map the file read-only
+ * and follow the commands with the same generation protocol.
+ */
+
+#ifndef AESD_EMU_H
+#define AESD_EMU_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "aesd-history.h"
+
+/**
+ * An emulated device. All functions taking one are thread safe.
+ */
+struct aesd_emu
+{
+    pthread_mutex_t lock;
+    struct aesd_history history;
+    /**
+     * The shared mapping, header first
+     */
+    struct aesd_mmap_header *header;
+    size_t map_size;
+    /**
+     * Storage the header's entry offsets refer to, see aesd_history_sync_header()
+     */
+    const char *synced_data;
+};
+
+/**
+ * An open file of an emulated device, the equivalent of struct aesd_file.
+ * A file must not be used by several threads at once.
+ */
+struct aesd_emu_file
+{
+    struct aesd_emu *emu;
+    struct aesd_partial partial;
+    long long pos;
+};
+
+extern int aesd_emu_open(struct aesd_emu *emu, const char *path, unsigned int entries, size_t data_size);
+
+extern void aesd_emu_close(struct aesd_emu *emu);
+
+extern void aesd_emu_file_open(struct aesd_emu_file *file, struct aesd_emu *emu);
+
+extern void aesd_emu_file_release(struct aesd_emu_file *file);
+
+extern ssize_t aesd_emu_file_write(struct aesd_emu_file *file, const void *buf, size_t count);
+
+extern ssize_t aesd_emu_file_writev(struct aesd_emu_file *file, const struct iovec *iov, int iovcnt);
+
+extern ssize_t aesd_emu_file_pread(struct aesd_emu_file *file, void *buf, size_t count, long long pos);
+
+extern ssize_t aesd_emu_file_read(struct aesd_emu_file *file, void *buf, size_t count);
+
+extern long long aesd_emu_file_llseek(struct aesd_emu_file *file, long long offset, int whence);
+
+extern int aesd_emu_file_seekto(struct aesd_emu_file *file, uint32_t write_cmd, uint32_t write_cmd_offset);
+
+#endif /* AESD_EMU_H */
@@ -0,0 +1,412 @@
+/**
+ * @file aesd-history.c
+ * @brief Device independent core of the aesdchar driver
+ *
+ * Splitting writes into commands, keeping incomplete writes, resolving file
+ * positions and describing the history for mmap() readers. Nothing here
+ * locks or touches user memory directly, so the same code runs in the kernel
+ * module and in the user space emulator.
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/fs.h> // SEEK_SET
+#include <linux/slab.h>
+#include <linux/string.h>
+#define aesd_partial_alloc(size) kvmalloc(size, GFP_KERNEL)
+#define aesd_partial_dealloc(ptr) kvfree(ptr)
+#else
+#include <errno.h>
+#include <stdio.h> // SEEK_SET
+#include <stdlib.h>
+#include <string.h>
+#define aesd_partial_alloc(size) malloc(size)
+#define aesd_partial_dealloc(ptr) free(ptr)
+#endif
+
+#include "aesd-history.h"
+#include "aesd-scan.h"
+
+/**
+ * Newline offsets gathered per scan when splitting a write into commands
+ */
+#define AESD_HISTORY_SCAN_BATCH 32
+
+/**
+* Make room for @param len more bytes in @param partial, growing it geometrically
+* @return 0 on success, -EFBIG past @param max_size bytes or -ENOMEM
+*/
+static int aesd_partial_reserve(struct aesd_partial *partial, size_t len, size_t max_size)
+{
+    size_t need = partial->size + len;
+    size_t capacity;
+    char *data;
+
+    if (need < len || need > max_size)
+        return -EFBIG;
+    if (need <= partial->capacity)
+        return 0;
+
+    capacity = partial->capacity * 2;
+    if (capacity < need)
+        capacity = need;
+    if (capacity < AESD_PARTIAL_MIN_CAPACITY)
+        capacity = AESD_PARTIAL_MIN_CAPACITY;
+    data = aesd_partial_alloc(capacity);
+    if (!data)
+        return -ENOMEM;
+    if (partial->size != 0)
+        memcpy(data, partial->data, partial->size);
+    aesd_partial_dealloc(partial->data);
+    partial->data = data;
+    partial->capacity = capacity;
+    return 0;
+}
+
+/**
+* Append @param len bytes from @param src to @param partial
+*/
+static int aesd_partial_append(struct aesd_partial *partial, const char *src, size_t len, size_t max_size)
+{
+    int result = aesd_partial_reserve(partial, len, max_size);
+
+    if (result)
+        return result;
+    memcpy(partial->data + partial->size, src, len);
+    partial->size += len;
+    return 0;
+}
+
+/**
+* Free the storage of @param partial, dropping any bytes it holds
+*/
+void aesd_partial_free(struct aesd_partial *partial)
+{
+    aesd_partial_dealloc(partial->data);
+    partial->data = NULL;
+    partial->size = 0;
+    partial->capacity = 0;
+}
+
+/**
+* Initializes @param history to keep up to @param entries commands and, if @param byte_budget is
+* nonzero, at most that many bytes of them, stored in an arena of @param arena_size bytes growing
+* up to @param arena_max_size. @param ops is called around every change.
+* @return 0 on success or -EINVAL for an unsupported number of entries
+*/
+int aesd_history_init(struct aesd_history *history, unsigned int entries, size_t byte_budget,
+            size_t arena_size, size_t arena_max_size, const struct aesd_history_ops *ops)
+{
+    int result;
+
+    memset(history, 0, sizeof(*history));
+    result = aesd_circular_buffer_init_capacity(&history->buffer, entries, byte_budget);
+    if (result)
+        return result;
+    aesd_arena_init(&history->arena, arena_size, arena_max_size);
+    history->ops = ops;
+    return 0;
+}
+
+/**
+* Frees everything @param history holds
+*/
+void aesd_history_free(struct aesd_history *history)
+{
+    /* Entries point into the arena */
+    aesd_circular_buffer_release(&history->buffer);
+    aesd_arena_free(&history->arena);
+    aesd_partial_free(&history->orphan);
+}
+
+/**
+* Reserve @param len bytes for the next commands at the head of the arena of @param history,
+* setting @param dest_rtn to where they go. Reserving may evict or move entries, so it counts
+* as an update. A grow allocates and copies to the new storage before the update and frees the
+* old storage after it, so the update itself never sleeps.
+* @return 0 on success, -EFBIG or -ENOMEM
+*/
+int aesd_history_reserve(struct aesd_history *history, size_t len, char **dest_rtn)
+{
+    char *data;
+    char *old;
+    size_t size;
+    int result;
+
+    result = aesd_arena_prepare_grow(&history->arena, &history->buffer, len, &data, &size);
+    if (result)
+        return result;
+
+    history->ops->update_begin(history);
+    old = aesd_arena_finish_grow(&history->arena, &history->buffer, data, size);
+    result = aesd_arena_reserve(&history->arena, &history->buffer, len, dest_rtn);
+    history->ops->update_end(history, 0);
+
+    aesd_arena_release_storage(old);
+    return result;
+}
+
+/**
+* Add every newline terminated command among the @param len bytes just filled in at the reserved
+* arena head @param dest of @param history, all in one update. Nothing changes when there is no
+* newline.
+* @return the bytes used, through the last newline
+*/
+size_t aesd_history_commit_lines(struct aesd_history *history, const char *dest, size_t len)
+{
+    size_t offsets[AESD_HISTORY_SCAN_BATCH];
+    struct aesd_buffer_entry entry;
+    size_t scanned;
+    size_t found;
+    size_t index;
+    size_t base = 0;
+    size_t used = 0;
+    uint32_t added = 0;
+
+    found = aesd_scan_newlines(dest, len, offsets, AESD_HISTORY_SCAN_BATCH, &scanned);
+    if (found == 0)
+        return 0;
+
+    history->ops->update_begin(history);
+    do {
+        for (index = 0; index < found; index++) {
+            aesd_arena_append(&history->arena, base + offsets[index] + 1 - used);
+            aesd_arena_commit(&history->arena, &entry);
+            aesd_circular_buffer_add_entry(&history->buffer, &entry);
+            used = base + offsets[index] + 1;
+        }
+        added += found;
+        base += scanned;
+        found = base < len ? aesd_scan_newlines(dest + base, len - base, offsets, AESD_HISTORY_SCAN_BATCH,
+                    &scanned) : 0;
+    } while (found != 0);
+    history->ops->update_end(history, added);
+    return used;
+}
+
+/**
+* Store @param count bytes, produced by @param copy from @param source, in @param history as one
+* write through the file whose incomplete write is @param partial: every newline completes a
+* command, and the bytes after the last one are kept in @param partial.
+* @return count; fewer bytes if commands were stored but the bytes after them could not be kept,
+* so a retry resends only those; or a negative error, in which case nothing was stored
+*/
+ssize_t aesd_history_write(struct aesd_history *history, struct aesd_partial *partial,
+            aesd_history_copy_fn copy, void *source, size_t count)
+{
+    size_t max_size = history->arena.max_size;
+    struct aesd_partial orphan;
+    bool adopted = false;
+    size_t len = count;
+    size_t used;
+    char *dest;
+    int result;
+
+    /* Pick up a command left unterminated by a file that has since been closed */
+    if (partial->size == 0 && history->orphan.size != 0) {
+        orphan = history->orphan;
+        history->orphan = *partial;
+        *partial = orphan;
+        adopted = true;
+    }
+
+    if (partial->size == 0) {
+        /* Copy once, straight into the arena; the copy only touches bytes no entry uses */
+        result = aesd_history_reserve(history, count, &dest);
+        if (result)
+            return result;
+        result = copy(source, dest, count);
+        if (result)
+            return result;
+    } else {
+        /* Continue the fragment, moving it to the arena once a command is complete */
+        result = aesd_partial_reserve(partial, count, max_size);
+        if (result)
+            goto out_restore;
+        result = copy(source, partial->data + partial->size, count);
+        if (result)
+            goto out_restore;
+
+        if (aesd_scan_newline(partial->data + partial->size, count) == NULL) {
+            partial->size += count;
+            history->partial_bytes += count;
+            return count;
+        }
+        len = partial->size + count;
+        result = aesd_history_reserve(history, len, &dest);
+        if (result)
+            goto out_restore;
+        memcpy(dest, partial->data, len);
+        history->partial_bytes -= partial->size;
+        partial->size = 0;
+    }
+
+    /* Any bytes after the last newline wait for the rest of their command */
+    used = aesd_history_commit_lines(history, dest, len);
+    if (used < len) {
+        /* Only a fresh fragment allocates here: a continued one already has the capacity */
+        result = aesd_partial_append(partial, dest + used, len - used, max_size);
+        if (result)
+            return used != 0 ? (ssize_t)(count - (len - used)) : result;
+        history->partial_bytes += len - used;
+    }
+    return count;
+
+out_restore:
+    /* Give an adopted fragment back, so it still waits for the next writer */
+    if (adopted) {
+        orphan = *partial;
+        *partial = history->orphan;
+        history->orphan = orphan;
+    }
+    return result;
+}
+
+/**
+* Hand the incomplete write @param partial of a file being closed to @param history, so "echo -n"
+* followed by another write still forms one command. The caller frees @param partial afterwards.
+*/
+void aesd_history_release_partial(struct aesd_history *history, struct aesd_partial *partial)
+{
+    struct aesd_partial orphan;
+
+    if (partial->size == 0)
+        return;
+    if (history->orphan.size == 0) {
+        orphan = history->orphan;
+        history->orphan = *partial;
+        *partial = orphan;
+    } else if (aesd_partial_append(&history->orphan, partial->data, partial->size,
+                history->arena.max_size)) {
+        /* No room to keep it: the fragment is dropped */
+        history->partial_bytes -= partial->size;
+    }
+}
+
+/**
+* Find the bytes of @param history stored at @param pos, at most @param len of them. Only reads
+* the history, so lockless callers may use it as long as they validate the result.
+* @return the number of bytes available at @param src_rtn, 0 at the end of the stored data
+*/
+size_t aesd_history_locate(struct aesd_history *history, size_t pos, size_t len, const char **src_rtn)
+{
+    struct aesd_buffer_entry *entry;
+    size_t entry_offset;
+
+    /* Each lookup is a binary search over the cached entry start offsets */
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&history->buffer, pos, &entry_offset);
+    if (entry == NULL)
+        return 0;
+    *src_rtn = entry->buffptr + entry_offset;
+    return entry->size - entry_offset < len ? entry->size - entry_offset : len;
+}
+
+/**
+* Resolve an lseek() from @param pos by @param offset relative to @param whence
+* @return the new position within the stored data of @param history, or -EINVAL
+*/
+long long aesd_history_seek(struct aesd_history *history, long long pos, long long offset, int whence)
+{
+    size_t total_size = aesd_circular_buffer_total_size(&history->buffer);
+    long long new_pos;
+
+    switch (whence) {
+        case SEEK_SET:
+            new_pos = offset;
+            break;
+        case SEEK_CUR:
+            new_pos = pos + offset;
+            break;
+        case SEEK_END:
+            new_pos = (long long)total_size + offset;
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    if (new_pos < 0 || new_pos > (long long)total_size)
+        return -EINVAL;
+    return new_pos;
+}
+
+/**
+* Resolve an AESDCHAR_IOCSEEKTO to byte @param write_cmd_offset of command @param write_cmd
+* @return the position within the stored data of @param history, or -EINVAL if there is no such byte
+*/
+long long aesd_history_seekto(struct aesd_history *history, uint32_t write_cmd, uint32_t write_cmd_offset)
+{
+    struct aesd_buffer_entry *cmd_entry;
+    size_t cmd_start;
+
+    /* Look up the command and its cached start offset; NULL if write_cmd is out of range */
+    cmd_entry = aesd_circular_buffer_get_entry(&history->buffer, write_cmd, &cmd_start);
+    if (cmd_entry == NULL || write_cmd_offset >= cmd_entry->size)
+        return -EINVAL;
+    return cmd_start + write_cmd_offset;
+}
+
+/**
+* @return the bytes needed for the mmap header of @param history, before rounding to pages
+*/
+size_t aesd_history_header_size(struct aesd_history *history)
+{
+    return sizeof(struct aesd_mmap_header) + history->buffer.slots * sizeof(struct aesd_mmap_entry);
+}
+
+/**
+* Publish @param entry of @param history in its slot of @param header
+*/
+static void aesd_history_set_entry(struct aesd_history *history, struct aesd_mmap_header *header,
+            const struct aesd_buffer_entry *entry)
+{
+    struct aesd_mmap_entry *slot = &header->entries[entry - history->buffer.entry];
+
+    slot->offset = entry->buffptr - history->arena.data;
+    slot->size = entry->size;
+}
+
+/**
+* Fill in the zeroed @param header of @param header_size bytes, a multiple of the page size,
+* describing @param history; the data region follows it. @param synced_data is then kept for
+* aesd_history_sync_header().
+*/
+void aesd_history_init_header(struct aesd_history *history, struct aesd_mmap_header *header,
+            size_t header_size, const char **synced_data)
+{
+    header->magic = AESD_MMAP_MAGIC;
+    header->version = AESD_MMAP_VERSION;
+    header->data_offset = header_size;
+    header->slots = history->buffer.slots;
+    *synced_data = NULL;
+    aesd_history_sync_header(history, header, synced_data, 0);
+}
+
+/**
+* Bring @param header in line with @param history: every entry after the arena moved away from
+* @param synced_data, otherwise only the @param added newest ones
+*/
+void aesd_history_sync_header(struct aesd_history *history, struct aesd_mmap_header *header,
+            const char **synced_data, uint32_t added)
+{
+    struct aesd_circular_buffer *buffer = &history->buffer;
+    uint32_t count = aesd_circular_buffer_entry_count(buffer);
+    struct aesd_buffer_entry *entry;
+    uint32_t index;
+
+    if (*synced_data != history->arena.data) {
+        *synced_data = history->arena.data;
+        header->data_epoch++;
+        header->data_size = history->arena.size;
+        index = 0;
+    } else {
+        index = count - (added < count ? added : count);
+    }
+    for (; index < count; index++) {
+        aesd_history_set_entry(history, header, aesd_circular_buffer_get_entry(buffer, index, NULL));
+    }
+
+    entry = aesd_circular_buffer_get_entry(buffer, 0, NULL);
+    header->first = entry != NULL ? entry - buffer->entry : 0;
+    header->count = count;
+}
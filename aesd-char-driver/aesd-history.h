@@ -0,0 +1,111 @@
+/*
+ * aesd-history.h
+ *
+ * Device independent core of the aesdchar driver: the command history with
+ * its storage, incomplete writes and position arithmetic. Builds both in the
+ * kernel module and in user space (see aesd-emu.h).
+ */
+
+#ifndef AESD_HISTORY_H
+#define AESD_HISTORY_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h> // size_t
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h> // ssize_t
+#endif
+
+#include "aesd-circular-buffer.h"
+#include "aesd-arena.h"
+#include "aesd_mmap.h"
+
+/**
+ * Smallest allocation for an incomplete write
+ */
+#define AESD_PARTIAL_MIN_CAPACITY 256
+
+/**
+ * Bytes of a command still waiting for its newline
+ */
+struct aesd_partial
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+struct aesd_history;
+
+/**
+ * Callbacks into the owner of a history
+ */
+struct aesd_history_ops
+{
+    /**
+     * Called around every change to the entries or the arena, update_end() with the number
+     * of commands the change added. Lets the owner tell lockless readers to retry and
+     * publish the change.
+     */
+    void (*update_begin)(struct aesd_history *history);
+    void (*update_end)(struct aesd_history *history, uint32_t added);
+};
+
+/**
+ * Copies the next len bytes of the write being stored to dest
+ * @return 0 on success or -EFAULT
+ */
+typedef int (*aesd_history_copy_fn)(void *source, char *dest, size_t len);
+
+/**
+ * Commands and their storage. Any necessary locking must be performed by the caller:
+ * every function below except aesd_history_locate() changes or depends on the history.
+ */
+struct aesd_history
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_arena arena;
+    /**
+     * Incomplete write left behind by a closed file; the next writer without one adopts it
+     */
+    struct aesd_partial orphan;
+    /**
+     * Bytes in all incomplete writes, the orphan included
+     */
+    size_t partial_bytes;
+    const struct aesd_history_ops *ops;
+};
+
+extern void aesd_partial_free(struct aesd_partial *partial);
+
+extern int aesd_history_init(struct aesd_history *history, unsigned int entries, size_t byte_budget,
+            size_t arena_size, size_t arena_max_size, const struct aesd_history_ops *ops);
+
+extern void aesd_history_free(struct aesd_history *history);
+
+extern int aesd_history_reserve(struct aesd_history *history, size_t len, char **dest_rtn);
+
+extern size_t aesd_history_commit_lines(struct aesd_history *history, const char *dest, size_t len);
+
+extern ssize_t aesd_history_write(struct aesd_history *history, struct aesd_partial *partial,
+            aesd_history_copy_fn copy, void *source, size_t count);
+
+extern void aesd_history_release_partial(struct aesd_history *history, struct aesd_partial *partial);
+
+extern size_t aesd_history_locate(struct aesd_history *history, size_t pos, size_t len, const char **src_rtn);
+
+extern long long aesd_history_seek(struct aesd_history *history, long long pos, long long offset, int whence);
+
+extern long long aesd_history_seekto(struct aesd_history *history, uint32_t write_cmd, uint32_t write_cmd_offset);
+
+extern size_t aesd_history_header_size(struct aesd_history *history);
+
+extern void aesd_history_init_header(struct aesd_history *history, struct aesd_mmap_header *header,
+            size_t header_size, const char **synced_data);
+
+extern void aesd_history_sync_header(struct aesd_history *history, struct aesd_mmap_header *header,
+            const char **synced_data, uint32_t added);
+
+#endif /* AESD_HISTORY_H */
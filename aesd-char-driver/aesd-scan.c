@@ -0,0 +1,214 @@
+/**
+ * @file aesd-scan.c
+ * @brief Newline scanning for command framing
+ *
+ * Used by aesd_write to split writes into commands and by aesdsocket to
+ * frame received lines. Each implementation reports every newline of a
+ * chunk in one pass so callers never rescan bytes they already examined.
+ */
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#else
+#include <string.h>
+#endif
+
+#include "aesd-scan.h"
+
+#if !defined(__KERNEL__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define SCAN_WORD_ONES  (~0UL / 0xff)
+#define SCAN_WORD_LOWS  (SCAN_WORD_ONES * 0x7f)
+#define SCAN_WORD_NL    (SCAN_WORD_ONES * '\n')
+
+/**
+ * Record the newline at pos; returns nonzero once offsets[] is full
+ */
+static inline int scan_record(size_t pos, size_t *offsets, size_t *count, size_t max_offsets,
+            size_t *scanned_rtn)
+{
+    offsets[(*count)++] = pos;
+    if (*count == max_offsets) {
+        *scanned_rtn = pos + 1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Byte loop for the tail shorter than one word or vector
+ */
+static size_t scan_bytes(const char *buf, size_t pos, size_t len, size_t *offsets, size_t count,
+            size_t max_offsets, size_t *scanned_rtn)
+{
+    for (; pos < len; pos++) {
+        if (buf[pos] == '\n' && scan_record(pos, offsets, &count, max_offsets, scanned_rtn)) {
+            return count;
+        }
+    }
+    *scanned_rtn = len;
+    return count;
+}
+
+/**
+ * Portable word-at-a-time implementation, always available
+ */
+size_t aesd_scan_newlines_swar(const char *buf, size_t len, size_t *offsets, size_t max_offsets,
+            size_t *scanned_rtn)
+{
+    size_t count = 0;
+    size_t pos = 0;
+
+    if (max_offsets == 0) {
+        *scanned_rtn = 0;
+        return 0;
+    }
+
+    for (; pos + sizeof(unsigned long) <= len; pos += sizeof(unsigned long)) {
+        unsigned long word;
+        size_t i;
+
+        memcpy(&word, buf + pos, sizeof(word));
+        word ^= SCAN_WORD_NL;
+        /* Exact zero byte test: high bit set only in bytes that were '\n' */
+        if (!(~(((word & SCAN_WORD_LOWS) + SCAN_WORD_LOWS) | word | SCAN_WORD_LOWS))) {
+            continue;
+        }
+        for (i = 0; i < sizeof(unsigned long); i++) {
+            if (buf[pos + i] == '\n' &&
+                scan_record(pos + i, offsets, &count, max_offsets, scanned_rtn)) {
+                return count;
+            }
+        }
+    }
+
+    return scan_bytes(buf, pos, len, offsets, count, max_offsets, scanned_rtn);
+}
+
+#ifdef AESD_SCAN_HAVE_X86_SIMD
+
+/**
+ * Emit every set bit of a comparison mask as a newline offset
+ */
+static inline int scan_record_mask(unsigned int mask, size_t base, size_t *offsets, size_t *count,
+            size_t max_offsets, size_t *scanned_rtn)
+{
+    while (mask) {
+        if (scan_record(base + __builtin_ctz(mask), offsets, count, max_offsets, scanned_rtn)) {
+            return 1;
+        }
+        mask &= mask - 1;
+    }
+    return 0;
+}
+
+size_t aesd_scan_newlines_sse2(const char *buf, size_t len, size_t *offsets, size_t max_offsets,
+            size_t *scanned_rtn)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t pos = 0;
+
+    if (max_offsets == 0) {
+        *scanned_rtn = 0;
+        return 0;
+    }
+
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + pos));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        if (mask && scan_record_mask(mask, pos, offsets, &count, max_offsets, scanned_rtn)) {
+            return count;
+        }
+    }
+
+    return scan_bytes(buf, pos, len, offsets, count, max_offsets, scanned_rtn);
+}
+
+__attribute__((target("avx2")))
+size_t aesd_scan_newlines_avx2(const char *buf, size_t len, size_t *offsets, size_t max_offsets,
+            size_t *scanned_rtn)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t pos = 0;
+
+    if (max_offsets == 0) {
+        *scanned_rtn = 0;
+        return 0;
+    }
+
+    // Two vectors per iteration keep long newline-free runs close to memory bandwidth
+    for (; pos + 64 <= len; pos += 64) {
+        __m256i lo = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + pos)), newline);
+        __m256i hi = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + pos + 32)), newline);
+        if (_mm256_testz_si256(_mm256_or_si256(lo, hi), _mm256_or_si256(lo, hi))) {
+            continue;
+        }
+        if (scan_record_mask((unsigned int)_mm256_movemask_epi8(lo), pos, offsets, &count,
+                             max_offsets, scanned_rtn) ||
+            scan_record_mask((unsigned int)_mm256_movemask_epi8(hi), pos + 32, offsets, &count,
+                             max_offsets, scanned_rtn)) {
+            return count;
+        }
+    }
+
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + pos));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+        if (mask && scan_record_mask(mask, pos, offsets, &count, max_offsets, scanned_rtn)) {
+            return count;
+        }
+    }
+
+    return scan_bytes(buf, pos, len, offsets, count, max_offsets, scanned_rtn);
+}
+
+typedef size_t (*scan_newlines_fn)(const char *, size_t, size_t *, size_t, size_t *);
+
+/**
+ * Pick the widest vector implementation once; racing first callers all
+ * store the same pointer
+ */
+static scan_newlines_fn scan_select(void)
+{
+    static scan_newlines_fn selected;
+
+    if (selected == NULL) {
+        __builtin_cpu_init();
+        selected = __builtin_cpu_supports("avx2") ? aesd_scan_newlines_avx2 : aesd_scan_newlines_sse2;
+    }
+    return selected;
+}
+
+#endif /* AESD_SCAN_HAVE_X86_SIMD */
+
+/**
+ * Find the newlines in buf[0..len) in a single pass using the fastest
+ * implementation available
+ */
+size_t aesd_scan_newlines(const char *buf, size_t len, size_t *offsets, size_t max_offsets,
+            size_t *scanned_rtn)
+{
+#ifdef AESD_SCAN_HAVE_X86_SIMD
+    return scan_select()(buf, len, offsets, max_offsets, scanned_rtn);
+#else
+    return aesd_scan_newlines_swar(buf, len, offsets, max_offsets, scanned_rtn);
+#endif
+}
+
+/**
+ * Find the first newline in buf[0..len)
+ */
+const char *aesd_scan_newline(const char *buf, size_t len)
+{
+    size_t offset;
+    size_t scanned;
+
+    if (aesd_scan_newlines(buf, len, &offset, 1, &scanned) == 0) {
+        return NULL;
+    }
+    return buf + offset;
+}
@@ -0,0 +1,53 @@
+/*
+ * aesd-scan.h
+ *
+ * Newline scanning shared by the aesdchar driver and aesdsocket
+ */
+
+#ifndef AESD_SCAN_H
+#define AESD_SCAN_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h> // size_t
+#endif
+
+/**
+ * Find the first newline in buf[0..len)
+ * @return a pointer to the newline, or NULL if there is none
+ */
+extern const char *aesd_scan_newline(const char *buf, size_t len);
+
+/**
+ * Find the newlines in buf[0..len) in a single pass.
+ * The offset of each newline (relative to buf) is stored in offsets[], in order,
+ * until max_offsets are recorded.
+ * @param scanned_rtn receives the number of bytes fully examined: len if fewer
+ *      than max_offsets newlines were found, otherwise one past the last recorded
+ *      newline. Scanning may resume at buf + *scanned_rtn.
+ * @return the number of offsets stored
+ */
+extern size_t aesd_scan_newlines(const char *buf, size_t len, size_t *offsets, size_t max_offsets,
+            size_t *scanned_rtn);
+
+/**
+ * Portable word-at-a-time implementation, always available
+ */
+extern size_t aesd_scan_newlines_swar(const char *buf, size_t len, size_t *offsets, size_t max_offsets,
+            size_t *scanned_rtn);
+
+#if !defined(__KERNEL__) && defined(__x86_64__)
+/**
+ * Vector implementations; aesd_scan_newlines picks the widest one the CPU supports.
+ * The kernel build uses the word-at-a-time path since it cannot touch vector
+ * registers without kernel_fpu_begin().
+ */
+#define AESD_SCAN_HAVE_X86_SIMD 1
+extern size_t aesd_scan_newlines_sse2(const char *buf, size_t len, size_t *offsets, size_t max_offsets,
+            size_t *scanned_rtn);
+extern size_t aesd_scan_newlines_avx2(const char *buf, size_t len, size_t *offsets, size_t max_offsets,
+            size_t *scanned_rtn);
+#endif
+
+#endif /* AESD_SCAN_H */
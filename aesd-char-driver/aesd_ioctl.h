@@ -33,14 +33,109 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * One command passed to AESDCHAR_IOCAPPENDV
+ */
+struct aesd_command {
+    /**
+     * User space address of the command bytes
+     */
+    uint64_t data;
+    /**
+     * Number of bytes, the last of which must be the command's only newline
+     */
+    uint64_t size;
+};
+
+/**
+ * Argument of AESDCHAR_IOCAPPENDV
+ */
+struct aesd_appendv {
+    /**
+     * User space address of an array of count struct aesd_command
+     */
+    uint64_t commands;
+    /**
+     * Number of commands, at most AESD_APPENDV_MAX_COMMANDS
+     */
+    uint32_t count;
+    /**
+     * Must be 0
+     */
+    uint32_t flags;
+    /**
+     * Set by the driver: the zero referenced write command (as used by AESDCHAR_IOCSEEKTO)
+     * of the first command of the batch still stored right after the append
+     */
+    uint32_t first_cmd;
+    /**
+     * Set by the driver: how many commands of the batch are still stored, the last ones of
+     * the batch. Fewer than count when the batch alone overflows the history.
+     */
+    uint32_t stored;
+};
+
+#define AESD_APPENDV_MAX_COMMANDS 1024
+
+/**
+ * Counters returned by AESDCHAR_IOCSTATS, totals since the module was loaded
+ */
+struct aesd_stats {
+    /**
+     * Commands added to the history and the bytes written to the device, including
+     * bytes still waiting for their newline
+     */
+    uint64_t commands_written;
+    uint64_t bytes_written;
+    /**
+     * Bytes returned by read()
+     */
+    uint64_t bytes_read;
+    /**
+     * Commands evicted to make room for newer ones
+     */
+    uint64_t evictions;
+    /**
+     * Bytes of unterminated writes currently waiting for their newline
+     */
+    uint64_t partial_bytes;
+    /**
+     * Acquisitions of the device lock and the total time spent waiting for it
+     */
+    uint64_t lock_acquisitions;
+    uint64_t lock_wait_ns;
+    /**
+     * Bytes and commands currently stored
+     */
+    uint64_t buffer_bytes;
+    uint64_t buffer_commands;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+/**
+ * Enable (nonzero) or disable (0) follow mode on an open file. In follow mode the file
+ * keeps its place in the command stream even as old commands are evicted, and a read
+ * at the end of the data blocks until a new command is written (or fails with EAGAIN
+ * for O_NONBLOCK files); poll() reports when new commands are readable.
+ */
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 2, int)
+/**
+ * Append a batch of complete commands in one call. Either every command is added or,
+ * on error, none is, and readers never observe part of a batch. Commands are independent
+ * of any unterminated write() on the file, which stays pending.
+ */
+#define AESDCHAR_IOCAPPENDV _IOWR(AESD_IOC_MAGIC, 3, struct aesd_appendv)
+/**
+ * Read the device counters, also shown in /sys/kernel/debug/aesdchar/<minor>/stats
+ */
+#define AESDCHAR_IOCSTATS _IOR(AESD_IOC_MAGIC, 4, struct aesd_stats)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 4
 
 #endif /* AESD_IOCTL_H */
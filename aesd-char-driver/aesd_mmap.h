@@ -0,0 +1,80 @@
+/*
+ * aesd_mmap.h
+ *
+ *  @brief Layout of the read-only mapping of an aesd char device
+ *
+ * mmap() of the device exposes two regions:
+ *  - at offset 0, struct aesd_mmap_header followed by one aesd_mmap_entry per
+ *    history slot;
+ *  - at header->data_offset, the storage the commands live in, of which the
+ *    first header->data_size bytes may be mapped.
+ * Command number i (0 being the oldest) is entries[(first + i) & (slots - 1)]
+ * for i < count, its bytes at data_offset + entry.offset.
+ *
+ * The driver updates the header while commands are written, so readers use
+ * the generation like a seqcount: read it, skip if odd, read the entries and
+ * the command bytes, then read it again and retry if it changed. When
+ * data_epoch differs from its value when the data region was mapped, the
+ * storage has moved: unmap and map the data region again (it may also have
+ * grown, see data_size).
+ */
+
+#ifndef AESD_MMAP_H
+#define AESD_MMAP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define AESD_MMAP_MAGIC     0x61657364 /* "aesd" */
+#define AESD_MMAP_VERSION   1
+
+struct aesd_mmap_entry {
+    /**
+     * Offset of the command within the data region
+     */
+    uint64_t offset;
+    /**
+     * Number of bytes in the command
+     */
+    uint64_t size;
+};
+
+struct aesd_mmap_header {
+    uint32_t magic;
+    uint32_t version;
+    /**
+     * Odd while the driver updates the history, incremented on every change
+     */
+    uint64_t generation;
+    /**
+     * Incremented whenever the data region is reallocated
+     */
+    uint64_t data_epoch;
+    /**
+     * Offset of the data region within the mapping, a multiple of the page size
+     */
+    uint64_t data_offset;
+    /**
+     * Bytes of the data region that may currently be mapped
+     */
+    uint64_t data_size;
+    /**
+     * Number of entries[], a power of two
+     */
+    uint32_t slots;
+    /**
+     * Slot of the oldest command
+     */
+    uint32_t first;
+    /**
+     * Number of commands stored
+     */
+    uint32_t count;
+    uint32_t reserved;
+    struct aesd_mmap_entry entries[];
+};
+
+#endif /* AESD_MMAP_H */
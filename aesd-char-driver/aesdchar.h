@@ -8,8 +8,11 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#include "aesd-circular-buffer.h"
+#include "aesd-history.h"
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
 
 #define AESD_DEBUG 1  //Remove comment on this line to enable debug
 
@@ -26,18 +29,46 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/**
+ * Counters kept per CPU so updating them never contends; see struct aesd_stats
+ */
+struct aesd_pcpu_stats
+{
+    u64 commands_written;
+    u64 bytes_written;
+    u64 bytes_read;
+    u64 evictions;
+    u64 lock_acquisitions;
+    u64 lock_wait_ns;
+};
+
 struct aesd_dev
 {
     /**
      * TODO: Add structure(s) and locks needed to complete assignment requirements
      */
-    struct aesd_circular_buffer circular_buffer;
-    struct mutex lock;
+    struct aesd_history history; /* Entries, their storage and the orphaned fragment */
+    struct mutex lock;    /* Serializes writers; readers only take it when they keep racing one */
+    seqcount_mutex_t seq; /* Bumped by writers, who hold lock, around every change to the entries or the arena */
     struct cdev cdev;     /* Char device structure      */
-    char *partial_write_buffer;  /* Buffer for incomplete writes (awaiting newline) */
-    size_t partial_write_size;   /* Current size of partial write buffer */
-    size_t partial_write_capacity; /* Allocated capacity of partial write buffer */
      loff_t file_position;  /* Track current seek position */
+    wait_queue_head_t wait;  /* Followers waiting for the next command */
+    struct aesd_mmap_header *mmap_header; /* Header page(s) of the mapping, created by the first mmap */
+    size_t mmap_header_size;     /* Bytes allocated for mmap_header, a multiple of the page size */
+    const char *mmap_data;       /* Arena storage the header's entry offsets refer to */
+    struct aesd_pcpu_stats __percpu *stats;
+    uint32_t update_entries;     /* Entry count when the current update began, to count evictions */
+};
+
+/**
+ * State of one open file, kept in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    bool follow;             /* Follow mode, see AESDCHAR_IOCFOLLOW */
+    size_t stream_pos;       /* Follow mode read position, as a free-running stream offset */
+    struct aesd_partial partial; /* Incomplete write (awaiting newline) made through this file */
 };
 
 
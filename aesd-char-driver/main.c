@@ -16,27 +16,90 @@
 #include <linux/printk.h>
 #include <linux/types.h>
 #include <linux/cdev.h>
+#include <linux/debugfs.h>
 #include <linux/fs.h> // file_operations
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
 #include "aesdchar.h"
 #include "aesd_ioctl.h"
+#include "aesd-scan.h"
 
 /* Forward declarations */
 int aesd_open(struct inode *inode, struct file *filp);
 int aesd_release(struct inode *inode, struct file *filp);
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos);
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos);
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from);
 loff_t aesd_llseek(struct file *filp, loff_t offset, int whence);
 long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+__poll_t aesd_poll(struct file *filp, poll_table *wait);
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma);
 int aesd_init_module(void);
 void aesd_cleanup_module(void);
 
+/* Readers copy at most this much per lookup, through a bounce buffer */
+#define AESD_READ_CHUNK     PAGE_SIZE
+/* Lockless read attempts that may collide with a writer before taking dev->lock */
+#define AESD_READ_ATTEMPTS  4
+/* Upper bound for nr_devices */
+#define AESD_MAX_DEVICES    256
+
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
 MODULE_AUTHOR("Fusen He"); /** TODO: fill in your name **/
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+unsigned int history_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param(history_entries, uint, S_IRUGO);
+MODULE_PARM_DESC(history_entries, "Number of write commands kept (default 10)");
+
+unsigned long history_bytes = 0;
+module_param(history_bytes, ulong, S_IRUGO);
+MODULE_PARM_DESC(history_bytes, "Evict the oldest commands to keep at most this many bytes (0: no limit)");
+
+unsigned long arena_bytes = AESD_ARENA_DEFAULT_SIZE;
+module_param(arena_bytes, ulong, S_IRUGO);
+MODULE_PARM_DESC(arena_bytes, "Initial size of the command storage arena (default 16 KiB)");
+
+unsigned long arena_max_bytes = AESD_ARENA_DEFAULT_MAX_SIZE;
+module_param(arena_max_bytes, ulong, S_IRUGO);
+MODULE_PARM_DESC(arena_max_bytes, "Largest the arena grows before the oldest commands are evicted (default 64 MiB)");
+
+unsigned int nr_devices = 1;
+module_param(nr_devices, uint, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of independent devices (minors), each with its own history (default 1)");
+
+struct aesd_dev *aesd_devices;
+
+/* /sys/kernel/debug/aesdchar, one directory per minor */
+static struct dentry *aesd_debugfs_root;
+
+/* Bump a counter of dev on the local CPU */
+#define aesd_stat_add(dev, field, n) this_cpu_add((dev)->stats->field, (n))
+
+/**
+ * Take dev->lock, accounting the acquisition and, when it is contended, the time spent waiting
+ */
+static int aesd_lock(struct aesd_dev *dev)
+{
+    u64 start;
+
+    if (!mutex_trylock(&dev->lock)) {
+        start = ktime_get_ns();
+        if (mutex_lock_interruptible(&dev->lock))
+            return -ERESTARTSYS;
+        aesd_stat_add(dev, lock_wait_ns, ktime_get_ns() - start);
+    }
+    aesd_stat_add(dev, lock_acquisitions, 1);
+    return 0;
+}
 
 int aesd_open(struct inode *inode, struct file *filp)
 {
@@ -44,10 +107,13 @@ int aesd_open(struct inode *inode, struct file *filp)
     /**
      * TODO: handle open
      */
-    struct aesd_dev *dev;
+    struct aesd_file *file;
 
-    dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev;
+    file = kzalloc(sizeof(*file), GFP_KERNEL);
+    if (!file)
+        return -ENOMEM;
+    file->dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
+    filp->private_data = file;
 
     return 0;
 }
@@ -58,264 +124,497 @@ int aesd_release(struct inode *inode, struct file *filp)
     /**
      * TODO: handle release
      */
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+
+    /* An unterminated command outlives its file; the next writer without a fragment adopts it */
+    if (file->partial.size != 0) {
+        mutex_lock(&dev->lock);
+        aesd_history_release_partial(&dev->history, &file->partial);
+        mutex_unlock(&dev->lock);
+    }
+    aesd_partial_free(&file->partial);
+    kfree(file);
     return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos)
+/**
+ * Position to read from: f_pos, or for a follower its stream position converted to a file
+ * position. A follower that fell behind eviction skips ahead to the oldest command, and
+ * *first_rtn receives the stream offset actually read from.
+ */
+static size_t aesd_read_position(struct aesd_dev *dev, loff_t f_pos, const size_t *stream_pos,
+                size_t *first_rtn)
 {
-    struct aesd_dev *dev = filp->private_data;
+    size_t start;
+
+    if (stream_pos == NULL)
+        return f_pos;
+    start = aesd_circular_buffer_stream_start(&dev->history.buffer);
+    *first_rtn = max(*stream_pos, start);
+    return *first_rtn - start;
+}
+
+/**
+ * Copy up to len bytes at f_pos, or at *stream_pos for a follower, into the kernel buffer
+ * dest without taking dev->lock. *stream_pos is moved past any evicted bytes it skipped.
+ * The lookup and the copy are retried if a writer changed the history meanwhile, and
+ * only fall back to the mutex after AESD_READ_ATTEMPTS collisions or while a writer is
+ * mid-update. Arena storage replaced by a writer is freed after an RCU grace period, so
+ * the speculative copy never touches freed memory.
+ * Returns the number of bytes copied, 0 at the end of the stored data
+ */
+static ssize_t aesd_read_chunk(struct aesd_dev *dev, char *dest, size_t len, loff_t f_pos,
+                size_t *stream_pos)
+{
+    const char *src = NULL;
+    unsigned int seq;
+    size_t first = 0;
+    size_t copied;
+    int attempt;
+
+    for (attempt = 0; attempt < AESD_READ_ATTEMPTS; attempt++) {
+        rcu_read_lock();
+        seq = raw_read_seqcount(&dev->seq);
+        if (seq & 1) {
+            rcu_read_unlock();
+            break;
+        }
+
+        copied = aesd_history_locate(&dev->history, aesd_read_position(dev, f_pos, stream_pos, &first), len,
+                    &src);
+        /* src is only dereferenced once the lookup is known to be consistent */
+        if (!read_seqcount_retry(&dev->seq, seq)) {
+            memcpy(dest, src, copied);
+            if (!read_seqcount_retry(&dev->seq, seq)) {
+                rcu_read_unlock();
+                if (stream_pos != NULL)
+                    *stream_pos = first;
+                return copied;
+            }
+        }
+        rcu_read_unlock();
+    }
+
+    if (aesd_lock(dev))
+        return -ERESTARTSYS;
+    copied = aesd_history_locate(&dev->history, aesd_read_position(dev, f_pos, stream_pos, &first), len, &src);
+    memcpy(dest, src, copied);
+    mutex_unlock(&dev->lock);
+    if (stream_pos != NULL)
+        *stream_pos = first;
+    return copied;
+}
+
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct file *filp = iocb->ki_filp;
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    size_t count = iov_iter_count(to);
+    loff_t *f_pos = &iocb->ki_pos;
     ssize_t retval = 0;
     PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
     /**
      * TODO: handle read
      */
-    size_t total_size = 0;
-    uint8_t index;
-    struct aesd_buffer_entry *entry;
-    size_t bytes_to_copy;
-    char *user_buf_pos = buf;
-    size_t bytes_remaining = count;
-
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+    size_t *stream_pos = file->follow ? &file->stream_pos : NULL;
+    char *chunk;
+    ssize_t copied;
+
+    /* Readers copy through a bounce buffer: copying to user space may fault and sleep,
+     * which is not allowed inside the RCU read side. Every segment of to is filled in one call. */
+    chunk = kmalloc(min_t(size_t, count, AESD_READ_CHUNK), GFP_KERNEL);
+    if (!chunk)
+        return -ENOMEM;
 
-    /* Calculate total size of all entries in circular buffer */
-    if (dev->circular_buffer.full) {
-        /* Buffer is full, iterate through all entries starting from out_offs */
-        uint8_t current_idx = dev->circular_buffer.out_offs;
-        for (index = 0; index < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; index++) {
-            total_size += dev->circular_buffer.entry[current_idx].size;
-            current_idx = (current_idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    while ((size_t)retval < count) {
+        copied = aesd_read_chunk(dev, chunk, min_t(size_t, count - retval, AESD_READ_CHUNK), *f_pos,
+                    stream_pos);
+        if (copied < 0) {
+            if (retval == 0)
+                retval = copied;
+            break;
         }
-    } else {
-        /* Buffer not full, only count entries up to in_offs */
-        for (index = 0; index < dev->circular_buffer.in_offs; index++) {
-            total_size += dev->circular_buffer.entry[index].size;
+        if (copied == 0) {
+            /* End of the stored data; a follower that has read nothing yet waits for more */
+            if (stream_pos == NULL || retval > 0)
+                break;
+            if (filp->f_flags & O_NONBLOCK) {
+                retval = -EAGAIN;
+                break;
+            }
+            if (wait_event_interruptible(dev->wait,
+                        aesd_circular_buffer_stream_end(&dev->history.buffer) != *stream_pos)) {
+                retval = -ERESTARTSYS;
+                break;
+            }
+            continue;
+        }
+
+        if (copy_to_iter(chunk, copied, to) != copied) {
+            if (retval == 0)
+                retval = -EFAULT;
+            break;
         }
-    }
 
-    /* Return 0 if we've already read past all data or buffer is empty */
-    if (*f_pos >= total_size) {
-        goto out;
+        if (stream_pos != NULL)
+            *stream_pos += copied;
+        *f_pos += copied;
+        retval += copied;
     }
 
-    /* Copy data from circular buffer, handling offset */
-    size_t current_offset = 0;
-    uint8_t start_idx = dev->circular_buffer.full ? dev->circular_buffer.out_offs : 0;
-    uint8_t num_entries = dev->circular_buffer.full ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : dev->circular_buffer.in_offs;
-    uint8_t current_idx = start_idx;
+    kfree(chunk);
+    if (retval > 0)
+        aesd_stat_add(dev, bytes_read, retval);
+    return retval;
+}
 
-    for (index = 0; index < num_entries && bytes_remaining > 0; index++) {
-        entry = &dev->circular_buffer.entry[current_idx];
+/**
+ * Start changing the history; dev->lock must be held. Lockless readers and
+ * the generation in the mmap header tell readers to retry until aesd_update_end(),
+ * which is told how many commands the update added and wakes followers for them.
+ * Nothing between the two sleeps: a grow allocates before and frees after the update.
+ */
+static void aesd_update_begin(struct aesd_dev *dev)
+{
+    struct aesd_mmap_header *header = dev->mmap_header;
 
-        if (current_offset + entry->size > *f_pos) {
-            /* This entry contains data we need to read */
-            size_t entry_start_offset = (*f_pos > current_offset) ? (*f_pos - current_offset) : 0;
-            bytes_to_copy = min(bytes_remaining, (size_t)(entry->size - entry_start_offset));
+    dev->update_entries = aesd_circular_buffer_entry_count(&dev->history.buffer);
+    write_seqcount_begin(&dev->seq);
+    if (header != NULL) {
+        WRITE_ONCE(header->generation, header->generation + 1);
+        smp_wmb();
+    }
+}
 
-            if (copy_to_user(user_buf_pos, entry->buffptr + entry_start_offset, bytes_to_copy)) {
-                retval = -EFAULT;
-                goto out;
-            }
+static void aesd_update_end(struct aesd_dev *dev, uint32_t added)
+{
+    struct aesd_mmap_header *header = dev->mmap_header;
 
-            user_buf_pos += bytes_to_copy;
-            bytes_remaining -= bytes_to_copy;
-            *f_pos += bytes_to_copy;
-            retval += bytes_to_copy;
-        }
+    /* Commands only leave the history by eviction */
+    aesd_stat_add(dev, commands_written, added);
+    aesd_stat_add(dev, evictions,
+                dev->update_entries + added - aesd_circular_buffer_entry_count(&dev->history.buffer));
 
-        current_offset += entry->size;
-        current_idx = (current_idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    if (header != NULL) {
+        aesd_history_sync_header(&dev->history, header, &dev->mmap_data, added);
+        smp_wmb();
+        WRITE_ONCE(header->generation, header->generation + 1);
     }
+    write_seqcount_end(&dev->seq);
+    if (added != 0)
+        wake_up_interruptible(&dev->wait);
+}
 
-out:
-    mutex_unlock(&dev->lock);
-    return retval;
+static void aesd_history_update_begin(struct aesd_history *history)
+{
+    aesd_update_begin(container_of(history, struct aesd_dev, history));
+}
+
+static void aesd_history_update_end(struct aesd_history *history, uint32_t added)
+{
+    aesd_update_end(container_of(history, struct aesd_dev, history), added);
+}
+
+static const struct aesd_history_ops aesd_history_ops = {
+    .update_begin = aesd_history_update_begin,
+    .update_end = aesd_history_update_end,
+};
+
+/**
+ * Copy the next len bytes of the iov_iter source to dest
+ */
+static int aesd_copy_from_iter(void *source, char *dest, size_t len)
+{
+    return copy_from_iter(dest, len, source) == len ? 0 : -EFAULT;
+}
+
+/**
+ * Length of the next segment of from: one iovec of a writev, or everything left for
+ * single-buffer and kernel iterators
+ */
+static size_t aesd_iter_segment(const struct iov_iter *from)
+{
+    if (iter_is_iovec(from))
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+        return min(iov_iter_count(from), iter_iov_len(from));
+#else
+        return min(iov_iter_count(from), from->iov->iov_len - from->iov_offset);
+#endif
+    return iov_iter_count(from);
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                loff_t *f_pos)
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-    struct aesd_dev *dev = filp->private_data;
-    ssize_t retval = -ENOMEM;
-    PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
+    struct aesd_file *file = iocb->ki_filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    ssize_t retval = 0;
+    PDEBUG("write %zu bytes with offset %lld",iov_iter_count(from),iocb->ki_pos);
     /**
      * TODO: handle write
      */
-    char *kernel_buf;
-    char *newline_pos;
-    size_t bytes_before_newline;
-    struct aesd_buffer_entry *old_entry;
-
-    /* Copy data from user space */
-    kernel_buf = kmalloc(count, GFP_KERNEL);
-    if (!kernel_buf) {
-        return -ENOMEM;
-    }
+    ssize_t written;
+    size_t len;
 
-    if (copy_from_user(kernel_buf, buf, count)) {
-        kfree(kernel_buf);
-        return -EFAULT;
-    }
+    if (iov_iter_count(from) == 0)
+        return 0;
 
-    if (mutex_lock_interruptible(&dev->lock)) {
-        kfree(kernel_buf);
+    if (aesd_lock(dev))
         return -ERESTARTSYS;
-    }
-
-    /* Check if this write contains a newline */
-    newline_pos = memchr(kernel_buf, '\n', count);
-
-    if (newline_pos == NULL) {
-        /* No newline - append to partial buffer */
-        size_t new_size = dev->partial_write_size + count;
-        char *new_buffer = krealloc(dev->partial_write_buffer, new_size, GFP_KERNEL);
-        if (!new_buffer) {
-            kfree(kernel_buf);
-            mutex_unlock(&dev->lock);
-            return -ENOMEM;
-        }
-        memcpy(new_buffer + dev->partial_write_size, kernel_buf, count);
-        dev->partial_write_buffer = new_buffer;
-        dev->partial_write_size = new_size;
-        kfree(kernel_buf);
-        mutex_unlock(&dev->lock);
-        return count;
-    }
-
-    /* Newline found - complete the write */
-    bytes_before_newline = newline_pos - kernel_buf + 1; /* Include the newline */
-
-    if (dev->partial_write_size > 0) {
-        /* Combine partial buffer with current write up to newline */
-        size_t total_size = dev->partial_write_size + bytes_before_newline;
-        char *combined_buf = kmalloc(total_size, GFP_KERNEL);
-        if (!combined_buf) {
-            kfree(kernel_buf);
-            mutex_unlock(&dev->lock);
-            return -ENOMEM;
-        }
-        memcpy(combined_buf, dev->partial_write_buffer, dev->partial_write_size);
-        memcpy(combined_buf + dev->partial_write_size, kernel_buf, bytes_before_newline);
-
-        /* Free old partial buffer */
-        kfree(dev->partial_write_buffer);
-        dev->partial_write_buffer = NULL;
-        dev->partial_write_size = 0;
-        dev->partial_write_capacity = 0;
-
-        /* Free the oldest entry if buffer is full (will be overwritten) */
-        if (dev->circular_buffer.full) {
-            old_entry = &dev->circular_buffer.entry[dev->circular_buffer.out_offs];
-            if (old_entry->buffptr != NULL) {
-                kfree((char *)old_entry->buffptr);
-                old_entry->buffptr = NULL;
-                old_entry->size = 0;
-            }
-        }
 
-        /* Add combined entry to circular buffer */
-        struct aesd_buffer_entry entry;
-        entry.buffptr = combined_buf;
-        entry.size = total_size;
-        aesd_circular_buffer_add_entry(&dev->circular_buffer, &entry);
-        kfree(kernel_buf);
-    } else {
-        /* No partial buffer, just add this write up to newline */
-        char *entry_buf = kmalloc(bytes_before_newline, GFP_KERNEL);
-        if (!entry_buf) {
-            kfree(kernel_buf);
-            mutex_unlock(&dev->lock);
-            return -ENOMEM;
-        }
-        memcpy(entry_buf, kernel_buf, bytes_before_newline);
-
-        /* Free the oldest entry if buffer is full (will be overwritten) */
-        if (dev->circular_buffer.full) {
-            old_entry = &dev->circular_buffer.entry[dev->circular_buffer.out_offs];
-            if (old_entry->buffptr != NULL) {
-                kfree((char *)old_entry->buffptr);
-                old_entry->buffptr = NULL;
-                old_entry->size = 0;
-            }
+    /* Each segment behaves like its own write(), so a writev of many lines
+     * appends many commands under this one lock acquisition */
+    while (iov_iter_count(from) != 0) {
+        len = aesd_iter_segment(from);
+        written = aesd_history_write(&dev->history, &file->partial, aesd_copy_from_iter, from, len);
+        if (written < 0) {
+            if (retval == 0)
+                retval = written;
+            break;
         }
-
-        struct aesd_buffer_entry entry;
-        entry.buffptr = entry_buf;
-        entry.size = bytes_before_newline;
-        aesd_circular_buffer_add_entry(&dev->circular_buffer, &entry);
-        kfree(kernel_buf);
+        retval += written;
+        /* A short write stored commands but not the rest of the segment */
+        if ((size_t)written < len)
+            break;
     }
 
     mutex_unlock(&dev->lock);
-    retval = count;
+    if (retval > 0)
+        aesd_stat_add(dev, bytes_written, retval);
     return retval;
 }
 
+/**
+ * Move filp to position pos, keeping a follower's stream position in step; dev->lock must be held
+ */
+static void aesd_set_position(struct aesd_file *file, struct file *filp, loff_t pos)
+{
+    filp->f_pos = pos;
+    file->stream_pos = aesd_circular_buffer_stream_start(&file->dev->history.buffer) + pos;
+}
+
 loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
 {
-    struct aesd_dev *dev = filp->private_data;
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
     loff_t new_pos;
-    size_t total_size = 0;
-    uint8_t index;
 
     PDEBUG("llseek with offset %lld, whence %d", offset, whence);
 
-    if (mutex_lock_interruptible(&dev->lock))
+    if (aesd_lock(dev))
+        return -ERESTARTSYS;
+
+    /* Only positions within the stored data are valid */
+    new_pos = aesd_history_seek(&dev->history, filp->f_pos, offset, whence);
+    if (new_pos >= 0)
+        aesd_set_position(file, filp, new_pos);
+
+    mutex_unlock(&dev->lock);
+    return new_pos;
+}
+
+/**
+ * AESDCHAR_IOCSEEKTO: move to an offset within one of the stored commands
+ */
+static long aesd_ioctl_seekto(struct aesd_file *file, struct file *filp, unsigned long arg)
+{
+    struct aesd_dev *dev = file->dev;
+    struct aesd_seekto seekto;
+    loff_t pos;
+
+    /* Copy struct from user space */
+    if (copy_from_user(&seekto, (struct aesd_seekto __user *)arg, sizeof(seekto))) {
+        return -EFAULT;
+    }
+
+    if (aesd_lock(dev))
         return -ERESTARTSYS;
 
-    /* Calculate total size of all entries in circular buffer */
-    if (dev->circular_buffer.full) {
-        /* Buffer is full, iterate through all entries starting from out_offs */
-        uint8_t current_idx = dev->circular_buffer.out_offs;
-        for (index = 0; index < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; index++) {
-            total_size += dev->circular_buffer.entry[current_idx].size;
-            current_idx = (current_idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    /* Fails unless write_cmd is stored and write_cmd_offset lies within it */
+    pos = aesd_history_seekto(&dev->history, seekto.write_cmd, seekto.write_cmd_offset);
+    if (pos >= 0)
+        aesd_set_position(file, filp, pos);
+
+    mutex_unlock(&dev->lock);
+    return pos < 0 ? pos : 0;
+}
+
+/**
+ * AESDCHAR_IOCFOLLOW: switch follow mode on or off, keeping the current position
+ */
+static long aesd_ioctl_follow(struct aesd_file *file, struct file *filp, unsigned long arg)
+{
+    struct aesd_dev *dev = file->dev;
+    size_t start;
+    int enable;
+
+    if (get_user(enable, (int __user *)arg))
+        return -EFAULT;
+
+    if (aesd_lock(dev))
+        return -ERESTARTSYS;
+
+    start = aesd_circular_buffer_stream_start(&dev->history.buffer);
+    if (enable && !file->follow) {
+        file->stream_pos = start + filp->f_pos;
+    } else if (!enable && file->follow) {
+        filp->f_pos = max(file->stream_pos, start) - start;
+    }
+    file->follow = enable != 0;
+
+    mutex_unlock(&dev->lock);
+    return 0;
+}
+
+/**
+ * AESDCHAR_IOCAPPENDV: append a batch of complete commands. Every command is copied and
+ * checked in a kernel buffer before the history is touched, so a bad command leaves it
+ * untouched; the batch then goes into a single arena reservation, added within one update.
+ */
+static long aesd_ioctl_appendv(struct aesd_file *file, unsigned long arg)
+{
+    struct aesd_dev *dev = file->dev;
+    struct aesd_appendv __user *user_appendv = (struct aesd_appendv __user *)arg;
+    struct aesd_appendv appendv;
+    struct aesd_command *commands;
+    struct aesd_buffer_entry entry;
+    size_t total = 0;
+    uint32_t index;
+    uint32_t count;
+    char *batch = NULL;
+    char *dest;
+    char *pos;
+    long result;
+
+    if (copy_from_user(&appendv, user_appendv, sizeof(appendv)))
+        return -EFAULT;
+    if (appendv.count == 0 || appendv.count > AESD_APPENDV_MAX_COMMANDS || appendv.flags != 0)
+        return -EINVAL;
+
+    commands = kvmalloc_array(appendv.count, sizeof(*commands), GFP_KERNEL);
+    if (commands == NULL)
+        return -ENOMEM;
+    if (copy_from_user(commands, u64_to_user_ptr(appendv.commands), appendv.count * sizeof(*commands))) {
+        result = -EFAULT;
+        goto out_free;
+    }
+    for (index = 0; index < appendv.count; index++) {
+        if (commands[index].size == 0 || commands[index].size > SIZE_MAX - total) {
+            result = -EINVAL;
+            goto out_free;
         }
-    } else {
-        /* Buffer not full, only count entries up to in_offs */
-        for (index = 0; index < dev->circular_buffer.in_offs; index++) {
-            total_size += dev->circular_buffer.entry[index].size;
+        total += commands[index].size;
+    }
+    /* The arena could never hold the batch, so do not allocate for it */
+    if (total > dev->history.arena.max_size) {
+        result = -EFBIG;
+        goto out_free;
+    }
+
+    batch = kvmalloc(total, GFP_KERNEL);
+    if (batch == NULL) {
+        result = -ENOMEM;
+        goto out_free;
+    }
+    pos = batch;
+    for (index = 0; index < appendv.count; index++) {
+        if (copy_from_user(pos, u64_to_user_ptr(commands[index].data), commands[index].size)) {
+            result = -EFAULT;
+            goto out_free;
         }
+        /* Exactly one newline, at the end, so each record is one command */
+        if (pos[commands[index].size - 1] != '\n' ||
+            aesd_scan_newline(pos, commands[index].size - 1) != NULL) {
+            result = -EINVAL;
+            goto out_free;
+        }
+        pos += commands[index].size;
     }
 
-    /* Calculate new position based on whence */
-    switch (whence) {
-        case SEEK_SET:
-            new_pos = offset;
-            break;
-        case SEEK_CUR:
-            new_pos = filp->f_pos + offset;
-            break;
-        case SEEK_END:
-            new_pos = total_size + offset;
-            break;
-        default:
-            mutex_unlock(&dev->lock);
-            return -EINVAL;
+    if (aesd_lock(dev)) {
+        result = -ERESTARTSYS;
+        goto out_free;
     }
 
-    /* Validate the new position */
-    if (new_pos < 0 || new_pos > total_size) {
-        mutex_unlock(&dev->lock);
-        return -EINVAL;
+    /* Reserving may evict, so it only happens once the whole batch is known to be good */
+    result = aesd_history_reserve(&dev->history, total, &dest);
+    if (result)
+        goto out_unlock;
+    memcpy(dest, batch, total);
+
+    aesd_arena_append(&dev->history.arena, total);
+    aesd_update_begin(dev);
+    for (index = 0; index < appendv.count; index++) {
+        aesd_arena_commit_part(&dev->history.arena, commands[index].size, &entry);
+        aesd_circular_buffer_add_entry(&dev->history.buffer, &entry);
     }
+    count = aesd_circular_buffer_entry_count(&dev->history.buffer);
+    aesd_update_end(dev, appendv.count);
+    aesd_stat_add(dev, bytes_written, total);
 
-    /* Update file position */
-    filp->f_pos = new_pos;
+    /* The batch is the newest commands, though it may have evicted its own first ones */
+    appendv.stored = min(count, appendv.count);
+    appendv.first_cmd = count - appendv.stored;
 
+out_unlock:
     mutex_unlock(&dev->lock);
-    return new_pos;
+out_free:
+    kvfree(batch);
+    kvfree(commands);
+    if (result == 0 && copy_to_user(user_appendv, &appendv, sizeof(appendv)))
+        result = -EFAULT;
+    return result;
+}
+
+/**
+ * Sum the per-CPU counters of dev and sample the history
+ */
+static int aesd_get_stats(struct aesd_dev *dev, struct aesd_stats *stats)
+{
+    const struct aesd_pcpu_stats *pcpu;
+    int cpu;
+
+    memset(stats, 0, sizeof(*stats));
+    for_each_possible_cpu(cpu) {
+        pcpu = per_cpu_ptr(dev->stats, cpu);
+        stats->commands_written += READ_ONCE(pcpu->commands_written);
+        stats->bytes_written += READ_ONCE(pcpu->bytes_written);
+        stats->bytes_read += READ_ONCE(pcpu->bytes_read);
+        stats->evictions += READ_ONCE(pcpu->evictions);
+        stats->lock_acquisitions += READ_ONCE(pcpu->lock_acquisitions);
+        stats->lock_wait_ns += READ_ONCE(pcpu->lock_wait_ns);
+    }
+
+    /* Plain mutex_lock_interruptible(): looking at the counters should not change them */
+    if (mutex_lock_interruptible(&dev->lock))
+        return -ERESTARTSYS;
+    stats->buffer_bytes = aesd_circular_buffer_total_size(&dev->history.buffer);
+    stats->buffer_commands = aesd_circular_buffer_entry_count(&dev->history.buffer);
+    stats->partial_bytes = dev->history.partial_bytes;
+    mutex_unlock(&dev->lock);
+    return 0;
+}
+
+/**
+ * AESDCHAR_IOCSTATS: copy the device counters to user space
+ */
+static long aesd_ioctl_stats(struct aesd_file *file, unsigned long arg)
+{
+    struct aesd_stats stats;
+    int result;
+
+    result = aesd_get_stats(file->dev, &stats);
+    if (result)
+        return result;
+    if (copy_to_user((struct aesd_stats __user *)arg, &stats, sizeof(stats)))
+        return -EFAULT;
+    return 0;
 }
 
 long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-    struct aesd_dev *dev = filp->private_data;
-    struct aesd_seekto seekto;
-    loff_t new_pos = 0;
-    uint8_t index;
-    uint32_t cmd_count = 0;
+    struct aesd_file *file = filp->private_data;
 
     /* Validate command */
     if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC)
@@ -325,135 +624,313 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
     PDEBUG("ioctl command %u", cmd);
 
-    /* Copy struct from user space */
-    if (copy_from_user(&seekto, (struct aesd_seekto __user *)arg, sizeof(seekto))) {
-        return -EFAULT;
+    switch (cmd) {
+        case AESDCHAR_IOCSEEKTO:
+            return aesd_ioctl_seekto(file, filp, arg);
+        case AESDCHAR_IOCFOLLOW:
+            return aesd_ioctl_follow(file, filp, arg);
+        case AESDCHAR_IOCAPPENDV:
+            return aesd_ioctl_appendv(file, arg);
+        case AESDCHAR_IOCSTATS:
+            return aesd_ioctl_stats(file, arg);
+        default:
+            return -ENOTTY;
     }
+}
 
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+/**
+ * Always writable. Followers are readable once a command lands past their position;
+ * other files are always readable, a read at the end of the data returning 0.
+ */
+__poll_t aesd_poll(struct file *filp, poll_table *wait)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(filp, &dev->wait, wait);
+    if (!file->follow || aesd_circular_buffer_stream_end(&dev->history.buffer) != file->stream_pos)
+        mask |= EPOLLIN | EPOLLRDNORM;
+    return mask;
+}
 
-    /* Count the number of commands in the circular buffer */
-    if (dev->circular_buffer.full) {
-        cmd_count = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    } else {
-        cmd_count = dev->circular_buffer.in_offs;
-    }
+/**
+ * Page backing page offset pgoff of the mapping: the header, then the arena
+ * Returns NULL past the end of the arena
+ */
+static struct page *aesd_mmap_page(struct aesd_dev *dev, pgoff_t pgoff)
+{
+    struct aesd_mmap_header *header = smp_load_acquire(&dev->mmap_header);
+    pgoff_t header_pages = dev->mmap_header_size >> PAGE_SHIFT;
+
+    if (pgoff < header_pages)
+        return vmalloc_to_page((char *)header + (pgoff << PAGE_SHIFT));
+    pgoff -= header_pages;
+    if (dev->history.arena.data == NULL || pgoff >= DIV_ROUND_UP(dev->history.arena.size, PAGE_SIZE))
+        return NULL;
+    return vmalloc_to_page(dev->history.arena.data + (pgoff << PAGE_SHIFT));
+}
 
-    /* Validate write_cmd is within range */
-    if (seekto.write_cmd >= cmd_count) {
-        mutex_unlock(&dev->lock);
-        return -EINVAL;
+/**
+ * Resolve a page of the mapping without dev->lock: a writer faulting on a mapping of
+ * this device from copy_from_user would otherwise deadlock. The lookup is validated
+ * against the seqcount like a lockless read, and arena storage replaced by a grow is
+ * only freed after an RCU grace period, with the mapped pages keeping their own reference.
+ */
+static vm_fault_t aesd_vm_fault(struct vm_fault *vmf)
+{
+    struct aesd_dev *dev = vmf->vma->vm_private_data;
+    struct page *page;
+    unsigned int seq;
+
+    for (;;) {
+        rcu_read_lock();
+        seq = raw_read_seqcount(&dev->seq);
+        if (!(seq & 1)) {
+            page = aesd_mmap_page(dev, vmf->pgoff);
+            if (page != NULL)
+                get_page(page);
+            if (!read_seqcount_retry(&dev->seq, seq)) {
+                rcu_read_unlock();
+                break;
+            }
+            if (page != NULL)
+                put_page(page);
+        }
+        rcu_read_unlock();
+        cond_resched();
     }
 
-    /* Get the actual circular buffer entry index */
-    uint8_t cmd_index = (dev->circular_buffer.out_offs + seekto.write_cmd) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    struct aesd_buffer_entry *cmd_entry = &dev->circular_buffer.entry[cmd_index];
+    if (page == NULL)
+        return VM_FAULT_SIGBUS;
+    vmf->page = page;
+    return 0;
+}
 
-    /* Validate write_cmd_offset is within the command */
-    if (seekto.write_cmd_offset >= cmd_entry->size) {
-        mutex_unlock(&dev->lock);
-        return -EINVAL;
-    }
+static const struct vm_operations_struct aesd_vm_ops = {
+    .fault =            aesd_vm_fault,
+};
 
-    /* Calculate the absolute file position */
-    /* Sum all bytes from command 0 to command (write_cmd - 1) */
-    uint8_t start_idx = dev->circular_buffer.out_offs;
-    for (index = 0; index < seekto.write_cmd; index++) {
-        uint8_t current_idx = (start_idx + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        new_pos += dev->circular_buffer.entry[current_idx].size;
-    }
+/**
+ * Create and fill in the mmap header on first use; dev->lock must be held
+ */
+static int aesd_mmap_create_header(struct aesd_dev *dev)
+{
+    struct aesd_mmap_header *header;
+    size_t size;
 
-    /* Add the offset within the command */
-    new_pos += seekto.write_cmd_offset;
+    if (dev->mmap_header != NULL)
+        return 0;
 
-    /* Update file position */
-    filp->f_pos = new_pos;
+    size = PAGE_ALIGN(aesd_history_header_size(&dev->history));
+    header = vmalloc_user(size);
+    if (!header)
+        return -ENOMEM;
+    aesd_history_init_header(&dev->history, header, size, &dev->mmap_data);
+    dev->mmap_header_size = size;
+    smp_store_release(&dev->mmap_header, header);
+    return 0;
+}
 
+/**
+ * Map the history read-only: the header then the arena, see aesd_mmap.h
+ */
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    int result;
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EACCES;
+
+    if (aesd_lock(dev))
+        return -ERESTARTSYS;
+    result = aesd_mmap_create_header(dev);
     mutex_unlock(&dev->lock);
+    if (result)
+        return result;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+#endif
+    vma->vm_ops = &aesd_vm_ops;
+    vma->vm_private_data = dev;
     return 0;
 }
 
 struct file_operations aesd_fops = {
     .owner =            THIS_MODULE,
-    .read =             aesd_read,
-    .write =            aesd_write,
+    .read_iter =        aesd_read_iter,
+    .write_iter =       aesd_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read =      copy_splice_read,
+#else
+    .splice_read =      generic_file_splice_read,
+#endif
     .open =             aesd_open,
     .release =          aesd_release,
     .llseek =           aesd_llseek,
     .unlocked_ioctl =   aesd_ioctl,
+    .poll =             aesd_poll,
+    .mmap =             aesd_mmap,
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static int aesd_stats_show(struct seq_file *s, void *unused)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    struct aesd_stats stats;
+    int result;
+
+    result = aesd_get_stats(s->private, &stats);
+    if (result)
+        return result;
+    seq_printf(s, "commands_written %llu\n", stats.commands_written);
+    seq_printf(s, "bytes_written %llu\n", stats.bytes_written);
+    seq_printf(s, "bytes_read %llu\n", stats.bytes_read);
+    seq_printf(s, "evictions %llu\n", stats.evictions);
+    seq_printf(s, "partial_bytes %llu\n", stats.partial_bytes);
+    seq_printf(s, "lock_acquisitions %llu\n", stats.lock_acquisitions);
+    seq_printf(s, "lock_wait_ns %llu\n", stats.lock_wait_ns);
+    seq_printf(s, "buffer_bytes %llu\n", stats.buffer_bytes);
+    seq_printf(s, "buffer_commands %llu\n", stats.buffer_commands);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
+/**
+ * Add the debugfs directory of device index; debugfs is best effort, failures are ignored
+ */
+static void aesd_setup_debugfs(struct aesd_dev *dev, unsigned int index)
+{
+    struct dentry *dir;
+    char name[16];
+
+    snprintf(name, sizeof(name), "%u", index);
+    dir = debugfs_create_dir(name, aesd_debugfs_root);
+    debugfs_create_file("stats", S_IRUGO, dir, dev, &aesd_stats_fops);
+}
+
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index)
+{
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add (&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %u", err, index);
     }
     return err;
 }
 
+/**
+ * Initialize device index and make it visible to user space
+ */
+static int aesd_setup_dev(struct aesd_dev *dev, unsigned int index)
+{
+    int result;
+
+    result = aesd_history_init(&dev->history, history_entries, history_bytes, arena_bytes, arena_max_bytes,
+                &aesd_history_ops);
+    if (result) {
+        printk(KERN_ERR "Invalid history size %u entries\n", history_entries);
+        return result;
+    }
+    dev->stats = alloc_percpu(struct aesd_pcpu_stats);
+    if (!dev->stats) {
+        aesd_history_free(&dev->history);
+        return -ENOMEM;
+    }
+    mutex_init(&dev->lock);
+    seqcount_mutex_init(&dev->seq, &dev->lock);
+    init_waitqueue_head(&dev->wait);
+
+    aesd_setup_debugfs(dev, index);
+    result = aesd_setup_cdev(dev, index);
+    if (result) {
+        free_percpu(dev->stats);
+        aesd_history_free(&dev->history);
+    }
+    return result;
+}
+
+/**
+ * Remove a device set up by aesd_setup_dev() and free its storage
+ */
+static void aesd_teardown_dev(struct aesd_dev *dev)
+{
+    cdev_del(&dev->cdev);
 
+    aesd_history_free(&dev->history);
+    vfree(dev->mmap_header);
+    free_percpu(dev->stats);
+}
 
 int aesd_init_module(void)
 {
     dev_t dev = 0;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    unsigned int index;
+
+    if (nr_devices == 0 || nr_devices > AESD_MAX_DEVICES) {
+        printk(KERN_ERR "nr_devices must be between 1 and %d\n", AESD_MAX_DEVICES);
+        return -EINVAL;
+    }
+    result = alloc_chrdev_region(&dev, aesd_minor, nr_devices,
             "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
 
     /**
      * TODO: initialize the AESD specific portion of the device
      */
-    aesd_circular_buffer_init(&aesd_device.circular_buffer);
-    mutex_init(&aesd_device.lock);
-
-    result = aesd_setup_cdev(&aesd_device);
-
-    if( result ) {
-        unregister_chrdev_region(dev, 1);
+    aesd_devices = kcalloc(nr_devices, sizeof(*aesd_devices), GFP_KERNEL);
+    if (!aesd_devices) {
+        unregister_chrdev_region(dev, nr_devices);
+        return -ENOMEM;
     }
-    return result;
+    aesd_debugfs_root = debugfs_create_dir("aesdchar", NULL);
+
+    for (index = 0; index < nr_devices; index++) {
+        result = aesd_setup_dev(&aesd_devices[index], index);
+        if (result) {
+            debugfs_remove_recursive(aesd_debugfs_root);
+            while (index-- > 0) {
+                aesd_teardown_dev(&aesd_devices[index]);
+            }
+            kfree(aesd_devices);
+            unregister_chrdev_region(dev, nr_devices);
+            return result;
+        }
+    }
+    return 0;
 
 }
 
 void aesd_cleanup_module(void)
 {
     dev_t devno = MKDEV(aesd_major, aesd_minor);
-
-    cdev_del(&aesd_device.cdev);
+    unsigned int index;
 
     /**
      * TODO: cleanup AESD specific portions here as necessary
      */
-    uint8_t index;
-    struct aesd_buffer_entry *entry;
-
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.circular_buffer, index) {
-        if (entry->buffptr != NULL) {
-            kfree((char *)entry->buffptr);
-            entry->buffptr = NULL;
-        }
-    }
-
-    /* Free partial write buffer if it exists */
-    if (aesd_device.partial_write_buffer != NULL) {
-        kfree(aesd_device.partial_write_buffer);
-        aesd_device.partial_write_buffer = NULL;
+    /* Remove the stats files first, they point at the devices */
+    debugfs_remove_recursive(aesd_debugfs_root);
+    for (index = 0; index < nr_devices; index++) {
+        aesd_teardown_dev(&aesd_devices[index]);
     }
+    kfree(aesd_devices);
 
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, nr_devices);
 }
 
 
@@ -0,0 +1,231 @@
+/**
+ * aesdchar-stress: multi-reader stress test for the aesdchar driver
+ *
+ * Fills the device with lines that each repeat a single character, then
+ * runs 1, 2, 4, ... reader threads that pread() the history from offset 0
+ * for a fixed time and reports aggregate read throughput per thread count.
+ * With -w a writer thread keeps appending lines meanwhile; every line
+ * returned by a read is checked to be uniform, so a torn lockless read
+ * shows up as a failure. The driver only makes each page sized chunk of a
+ * read consistent, so a line may change where it crosses a chunk boundary.
+ *
+ * Usage: aesdchar-stress [-f device] [-t max_threads] [-s seconds] [-l line_len] [-r read_size] [-w]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+struct stress {
+    const char *path;
+    size_t line_len;
+    size_t read_size;
+    size_t chunk_size;
+    atomic_int stop;
+    atomic_size_t bytes;
+    atomic_size_t reads;
+    atomic_size_t torn;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_line(int fd, size_t line_len, char fill) {
+    char line[line_len];
+
+    memset(line, fill, line_len - 1);
+    line[line_len - 1] = '\n';
+    return write(fd, line, line_len) == (ssize_t)line_len ? 0 : -1;
+}
+
+/**
+ * Count the complete lines in buf that mix more than one character within one
+ * chunk_size aligned chunk, the unit the driver copies consistently
+ */
+static size_t count_torn_lines(const char *buf, size_t len, size_t chunk_size) {
+    size_t torn = 0;
+    const char *line = buf;
+    const char *end = buf + len;
+    const char *newline;
+
+    while ((newline = memchr(line, '\n', end - line)) != NULL) {
+        for (const char *p = line + 1; p < newline; p++) {
+            if (*p != p[-1] && (size_t)(p - buf) % chunk_size != 0) {
+                torn++;
+                break;
+            }
+        }
+        line = newline + 1;
+    }
+    return torn;
+}
+
+static void *reader_thread(void *args) {
+    struct stress *stress = (struct stress *)args;
+    char *buf = malloc(stress->read_size);
+    size_t bytes = 0;
+    size_t reads = 0;
+    size_t torn = 0;
+    int fd = open(stress->path, O_RDONLY);
+
+    if (fd < 0 || buf == NULL) {
+        perror(stress->path);
+        exit(1);
+    }
+    while (!atomic_load_explicit(&stress->stop, memory_order_relaxed)) {
+        ssize_t n = pread(fd, buf, stress->read_size, 0);
+        if (n < 0) {
+            perror("pread");
+            exit(1);
+        }
+        torn += count_torn_lines(buf, (size_t)n, stress->chunk_size);
+        bytes += (size_t)n;
+        reads++;
+    }
+    atomic_fetch_add(&stress->bytes, bytes);
+    atomic_fetch_add(&stress->reads, reads);
+    atomic_fetch_add(&stress->torn, torn);
+    close(fd);
+    free(buf);
+    return NULL;
+}
+
+static void *writer_thread(void *args) {
+    struct stress *stress = (struct stress *)args;
+    int fd = open(stress->path, O_WRONLY);
+    char fill = 'a';
+
+    if (fd < 0) {
+        perror(stress->path);
+        exit(1);
+    }
+    while (!atomic_load_explicit(&stress->stop, memory_order_relaxed)) {
+        if (write_line(fd, stress->line_len, fill) < 0) {
+            perror("write");
+            exit(1);
+        }
+        fill = fill == 'z' ? 'a' : fill + 1;
+    }
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct stress stress = {
+        .path = "/dev/aesdchar",
+        .line_len = 256,
+        .read_size = 4096,
+        .chunk_size = (size_t)sysconf(_SC_PAGESIZE),
+    };
+    long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = 2.0;
+    int with_writer = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:t:s:l:r:w")) != -1) {
+        switch (opt) {
+            case 'f':
+                stress.path = optarg;
+                break;
+            case 't':
+                max_threads = atol(optarg);
+                break;
+            case 's':
+                seconds = atof(optarg);
+                break;
+            case 'l':
+                stress.line_len = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                stress.read_size = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                with_writer = 1;
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-f device] [-t max_threads] [-s seconds] [-l line_len] [-r read_size] [-w]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (max_threads <= 0 || seconds <= 0 || stress.line_len < 2 || stress.line_len > 65536 ||
+        stress.read_size == 0) {
+        fprintf(stderr, "Threads, seconds, line length (2..65536) and read size must be positive\n");
+        return 1;
+    }
+
+    // Seed the history so the readers have something to copy from the first pass
+    int fd = open(stress.path, O_WRONLY);
+    if (fd < 0) {
+        perror(stress.path);
+        return 1;
+    }
+    for (char fill = 'a'; fill <= 'z'; fill++) {
+        if (write_line(fd, stress.line_len, fill) < 0) {
+            perror("write");
+            return 1;
+        }
+    }
+    close(fd);
+
+    printf("# device=%s line_len=%zu read_size=%zu seconds=%.1f writer=%s\n", stress.path, stress.line_len,
+           stress.read_size, seconds, with_writer ? "yes" : "no");
+    printf("%-8s %12s %10s %8s %8s\n", "threads", "reads/sec", "MiB/s", "scaling", "torn");
+
+    double base_rate = 0;
+    int failed = 0;
+    // Double the readers each step, finishing with exactly max_threads
+    for (long threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        pthread_t readers[threads];
+        pthread_t writer;
+
+        atomic_store(&stress.stop, 0);
+        atomic_store(&stress.bytes, 0);
+        atomic_store(&stress.reads, 0);
+        atomic_store(&stress.torn, 0);
+        if (with_writer) {
+            pthread_create(&writer, NULL, writer_thread, &stress);
+        }
+        double start = now_seconds();
+        for (long i = 0; i < threads; i++) {
+            pthread_create(&readers[i], NULL, reader_thread, &stress);
+        }
+        struct timespec duration = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+        nanosleep(&duration, NULL);
+        atomic_store(&stress.stop, 1);
+        for (long i = 0; i < threads; i++) {
+            pthread_join(readers[i], NULL);
+        }
+        double elapsed = now_seconds() - start;
+        if (with_writer) {
+            pthread_join(writer, NULL);
+        }
+
+        double rate = atomic_load(&stress.bytes) / elapsed;
+        if (threads == 1) {
+            base_rate = rate;
+        }
+        printf("%-8ld %12.0f %10.1f %7.2fx %8zu\n", threads, atomic_load(&stress.reads) / elapsed,
+               rate / (1024.0 * 1024.0), base_rate > 0 ? rate / base_rate : 0.0, atomic_load(&stress.torn));
+        if (atomic_load(&stress.torn) != 0) {
+            failed = 1;
+        }
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    if (failed) {
+        fprintf(stderr, "Torn lines observed\n");
+    }
+    return failed;
+}
@@ -0,0 +1,384 @@
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+#include <arpa/inet.h>
+
+#include "aesdsocket-config.h"
+#include "aesdsocket-rxbuf.h"
+
+#define CONFIG_LINE_MAX         1024
+#define CONFIG_MIN_RX_BUFFER    64
+// getopt_long value for options that only have a long form
+#define CONFIG_OPT_LONG         0x100
+
+static const char short_options[] = "c:dp:e:w:q:rml:b";
+
+static const struct option long_options[] = {
+    { "config",      required_argument, NULL, 'c' },
+    { "daemon",      no_argument,       NULL, 'd' },
+    { "port",        required_argument, NULL, 'p' },
+    { "event-loops", required_argument, NULL, 'e' },
+    { "workers",     required_argument, NULL, 'w' },
+    { "queue-depth", required_argument, NULL, 'q' },
+    { "reject",      no_argument,       NULL, 'r' },
+    { "max-line",    required_argument, NULL, 'l' },
+    { "batch",       no_argument,       NULL, 'b' },
+    { "listen",      required_argument, NULL, CONFIG_OPT_LONG },
+    { "backlog",     required_argument, NULL, CONFIG_OPT_LONG },
+    { "backend",     required_argument, NULL, CONFIG_OPT_LONG },
+    { "data-file",   required_argument, NULL, CONFIG_OPT_LONG },
+    { "rx-buffer",   required_argument, NULL, CONFIG_OPT_LONG },
+    { NULL, 0, NULL, 0 },
+};
+
+static const char *const backend_names[] = {
+    [BACKEND_CHARDEV] = "chardev",
+    [BACKEND_FILE] = "file",
+    [BACKEND_MEMORY] = "memory",
+    [BACKEND_EMU] = "emu",
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-d] [-c config_file] [-p port] [-m] [-b] [-l max_line]\n"
+            "          [-e event_loops | -w workers [-q queue_depth] [-r]]\n"
+            "          [--listen address] [--backlog n] [--backend chardev|file|memory|emu]\n"
+            "          [--data-file path] [--rx-buffer bytes]\n",
+            program);
+}
+
+/**
+ * Parse a decimal value in [min, max]; the whole string must be consumed
+ */
+static int parse_number(const char *key, const char *value, unsigned long min, unsigned long max,
+                        unsigned long *result) {
+    char *end;
+
+    errno = 0;
+    unsigned long parsed = strtoul(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || value[0] == '-' || parsed < min || parsed > max) {
+        fprintf(stderr, "Invalid value for %s: %s\n", key, value);
+        return -1;
+    }
+    *result = parsed;
+    return 0;
+}
+
+static int parse_bool(const char *key, const char *value, int *result) {
+    if (strcmp(value, "1") == 0 || strcasecmp(value, "yes") == 0 || strcasecmp(value, "true") == 0 ||
+        strcasecmp(value, "on") == 0) {
+        *result = 1;
+        return 0;
+    }
+    if (strcmp(value, "0") == 0 || strcasecmp(value, "no") == 0 || strcasecmp(value, "false") == 0 ||
+        strcasecmp(value, "off") == 0) {
+        *result = 0;
+        return 0;
+    }
+    fprintf(stderr, "Invalid value for %s: %s\n", key, value);
+    return -1;
+}
+
+/**
+ * Fill config with the built-in defaults
+ */
+void config_init_defaults(struct aesdsocket_config *config) {
+    memset(config, 0, sizeof(*config));
+    config->listen_address.s_addr = htonl(INADDR_ANY);
+    config->port = CONFIG_DEFAULT_PORT;
+    config->backlog = CONFIG_DEFAULT_BACKLOG;
+    config->backend = USE_AESD_CHAR_DEVICE ? BACKEND_CHARDEV : BACKEND_FILE;
+    config->rx_buffer_size = RXBUF_INITIAL_CAPACITY;
+    config->max_line = RXBUF_DEFAULT_MAX_LINE;
+    config->queue_depth = CONFIG_DEFAULT_QUEUE_DEPTH;
+}
+
+/**
+ * Apply one setting by its key (the long option name, e.g. "port")
+ * Returns 0 on success, -1 if the key is unknown or the value invalid
+ */
+int config_set(struct aesdsocket_config *config, const char *key, const char *value) {
+    unsigned long number;
+
+    if (strcmp(key, "daemon") == 0) {
+        return parse_bool(key, value, &config->daemon);
+    }
+    if (strcmp(key, "batch") == 0) {
+        return parse_bool(key, value, &config->batch);
+    }
+    if (strcmp(key, "reject") == 0) {
+        return parse_bool(key, value, &config->reject_when_full);
+    }
+    if (strcmp(key, "listen") == 0) {
+        if (inet_pton(AF_INET, value, &config->listen_address) != 1) {
+            fprintf(stderr, "Invalid listen address: %s\n", value);
+            return -1;
+        }
+        return 0;
+    }
+    if (strcmp(key, "backend") == 0) {
+        for (size_t i = 0; i < sizeof(backend_names) / sizeof(backend_names[0]); i++) {
+            if (strcmp(value, backend_names[i]) == 0) {
+                config->backend = (enum aesdsocket_backend)i;
+                return 0;
+            }
+        }
+        fprintf(stderr, "Unknown backend: %s\n", value);
+        return -1;
+    }
+    if (strcmp(key, "data-file") == 0) {
+        if (value[0] == '\0' || strlen(value) >= sizeof(config->data_path)) {
+            fprintf(stderr, "Invalid data file path: %s\n", value);
+            return -1;
+        }
+        strcpy(config->data_path, value);
+        return 0;
+    }
+    if (strcmp(key, "port") == 0) {
+        if (parse_number(key, value, 1, UINT16_MAX, &number) < 0) {
+            return -1;
+        }
+        config->port = (uint16_t)number;
+        return 0;
+    }
+    if (strcmp(key, "backlog") == 0) {
+        if (parse_number(key, value, 1, INT_MAX, &number) < 0) {
+            return -1;
+        }
+        config->backlog = (int)number;
+        return 0;
+    }
+    if (strcmp(key, "rx-buffer") == 0) {
+        if (parse_number(key, value, CONFIG_MIN_RX_BUFFER, SIZE_MAX / 2, &number) < 0) {
+            return -1;
+        }
+        config->rx_buffer_size = number;
+        return 0;
+    }
+    if (strcmp(key, "max-line") == 0) {
+        if (parse_number(key, value, 1, SIZE_MAX / 2, &number) < 0) {
+            return -1;
+        }
+        config->max_line = number;
+        return 0;
+    }
+    if (strcmp(key, "event-loops") == 0) {
+        if (parse_number(key, value, 0, INT_MAX, &number) < 0) {
+            return -1;
+        }
+        config->event_loops = (int)number;
+        return 0;
+    }
+    if (strcmp(key, "workers") == 0) {
+        if (parse_number(key, value, 0, INT_MAX, &number) < 0) {
+            return -1;
+        }
+        config->workers = (int)number;
+        return 0;
+    }
+    if (strcmp(key, "queue-depth") == 0) {
+        if (parse_number(key, value, 1, INT_MAX, &number) < 0) {
+            return -1;
+        }
+        config->queue_depth = number;
+        return 0;
+    }
+
+    fprintf(stderr, "Unknown setting: %s\n", key);
+    return -1;
+}
+
+/**
+ * Strip leading and trailing whitespace in place
+ */
+static char *trim(char *text) {
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+    *end = '\0';
+    return text;
+}
+
+/**
+ * Apply every "key = value" line of a config file; '#' starts a comment
+ * Returns 0 on success, -1 on a read or parse error
+ */
+int config_load_file(struct aesdsocket_config *config, const char *path) {
+    char line[CONFIG_LINE_MAX];
+    int line_number = 0;
+    int result = 0;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open config file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *key = trim(line);
+        if (*key == '\0') {
+            continue;
+        }
+
+        char *equals = strchr(key, '=');
+        if (equals == NULL) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, line_number);
+            result = -1;
+            break;
+        }
+        *equals = '\0';
+        key = trim(key);
+        char *value = trim(equals + 1);
+
+        if (config_set(config, key, value) < 0) {
+            fprintf(stderr, "%s:%d: invalid setting\n", path, line_number);
+            result = -1;
+            break;
+        }
+    }
+
+    if (result == 0 && ferror(file)) {
+        fprintf(stderr, "Error reading config file %s\n", path);
+        result = -1;
+    }
+    fclose(file);
+    return result;
+}
+
+/**
+ * Round the receive buffer size up to the power of two the ring requires
+ */
+static size_t round_up_power_of_two(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+/**
+ * Parse the command line, loading the file named by -c/--config first so
+ * that command line options override it, then validate the result
+ * Returns 0 on success, -1 on error (a message has been printed)
+ */
+int config_parse_args(struct aesdsocket_config *config, int argc, char *argv[]) {
+    int longindex;
+    int opt;
+
+    // First pass: only look for the config file, errors are reported by the second pass
+    opterr = 0;
+    while ((opt = getopt_long(argc, argv, short_options, long_options, NULL)) != -1) {
+        if (opt == 'c' && config_load_file(config, optarg) < 0) {
+            return -1;
+        }
+    }
+
+    // Second pass: command line settings override the config file
+    opterr = 1;
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, short_options, long_options, &longindex)) != -1) {
+        const char *key;
+        const char *value = optarg != NULL ? optarg : "1";
+
+        switch (opt) {
+            case 'c':
+                continue; /* Already loaded */
+            case 'm':
+                key = "backend";
+                value = backend_names[BACKEND_MEMORY];
+                break;
+            case CONFIG_OPT_LONG:
+                key = long_options[longindex].name;
+                break;
+            case '?':
+                print_usage(argv[0]);
+                return -1;
+            default:
+                // Every other short option has a long form of the same meaning
+                key = NULL;
+                for (const struct option *o = long_options; o->name != NULL; o++) {
+                    if (o->val == opt) {
+                        key = o->name;
+                        break;
+                    }
+                }
+                if (key == NULL) {
+                    print_usage(argv[0]);
+                    return -1;
+                }
+                break;
+        }
+
+        if (config_set(config, key, value) < 0) {
+            return -1;
+        }
+    }
+
+    if (config->event_loops > 0 && config->workers > 0) {
+        fprintf(stderr, "Event loops (-e) and workers (-w) are mutually exclusive\n");
+        return -1;
+    }
+    config->rx_buffer_size = round_up_power_of_two(config->rx_buffer_size);
+
+    return 0;
+}
+
+/**
+ * Resolve the data path for the configured backend
+ */
+const char *config_data_path(const struct aesdsocket_config *config) {
+    if (config->data_path[0] != '\0') {
+        return config->data_path;
+    }
+    switch (config->backend) {
+        case BACKEND_CHARDEV:
+            return CONFIG_CHARDEV_PATH;
+        case BACKEND_EMU:
+            return CONFIG_EMU_PATH;
+        default:
+            return CONFIG_FILE_PATH;
+    }
+}
+
+/**
+ * Name of a backend as accepted by the "backend" key
+ */
+const char *config_backend_name(enum aesdsocket_backend backend) {
+    return backend_names[backend];
+}
+
+/**
+ * Log the effective settings to syslog
+ */
+void config_log(const struct aesdsocket_config *config) {
+    char address[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &config->listen_address, address, sizeof(address));
+    syslog(LOG_INFO, "Listening on %s:%u backlog %d, backend %s (%s), rx buffer %zu, max line %zu%s",
+           address, config->port, config->backlog, config_backend_name(config->backend),
+           config->backend == BACKEND_MEMORY ? "in memory" : config_data_path(config),
+           config->rx_buffer_size, config->max_line, config->batch ? ", batched" : "");
+    if (config->event_loops > 0) {
+        syslog(LOG_INFO, "Mode: %d event loops", config->event_loops);
+    } else if (config->workers > 0) {
+        syslog(LOG_INFO, "Mode: %d workers, queue depth %zu%s", config->workers, config->queue_depth,
+               config->reject_when_full ? ", reject when full" : "");
+    } else {
+        syslog(LOG_INFO, "Mode: thread per connection");
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef AESDSOCKET_CONFIG_H
+#define AESDSOCKET_CONFIG_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/**
+ * Compile-time default backend; 1 selects the aesdchar device, 0 the data file
+ */
+#ifndef USE_AESD_CHAR_DEVICE
+#define USE_AESD_CHAR_DEVICE 1
+#endif
+
+#define CONFIG_DEFAULT_PORT         9000
+#define CONFIG_DEFAULT_BACKLOG      10
+#define CONFIG_DEFAULT_QUEUE_DEPTH  64
+#define CONFIG_CHARDEV_PATH         "/dev/aesdchar"
+#define CONFIG_FILE_PATH            "/var/tmp/aesdsocketdata"
+#define CONFIG_EMU_PATH             "/dev/shm/aesdchar-emu"
+#define CONFIG_EMU_ENTRIES          10
+#define CONFIG_EMU_DATA_SIZE        (1024 * 1024)
+
+/**
+ * Where received packets are stored
+ */
+enum aesdsocket_backend {
+    BACKEND_CHARDEV,    /* the aesdchar driver, one command per line */
+    BACKEND_FILE,       /* a regular data file, removed at startup and exit */
+    BACKEND_MEMORY,     /* the in-process append log */
+    BACKEND_EMU,        /* the aesdchar driver code emulated in-process on a shared memory file */
+};
+
+/**
+ * Runtime settings, filled from defaults, an optional config file and the
+ * command line (in that order, later sources win). Read-only once the server
+ * has started.
+ */
+struct aesdsocket_config {
+    int daemon;
+    struct in_addr listen_address;
+    uint16_t port;
+    int backlog;
+    enum aesdsocket_backend backend;
+    /**
+     * Data file or device path; empty selects the backend's default path
+     */
+    char data_path[PATH_MAX];
+    /**
+     * Initial receive ring capacity in bytes, rounded up to a power of two
+     */
+    size_t rx_buffer_size;
+    /**
+     * Longest accepted line, longer lines close the connection
+     */
+    size_t max_line;
+    int batch;
+    /**
+     * Event loop threads; 0 disables reactor mode
+     */
+    int event_loops;
+    /**
+     * Worker pool threads; 0 disables the worker pool
+     */
+    int workers;
+    size_t queue_depth;
+    int reject_when_full;
+};
+
+/**
+ * Fill config with the built-in defaults
+ */
+void config_init_defaults(struct aesdsocket_config *config);
+
+/**
+ * Apply one setting by its key (the long option name, e.g. "port")
+ * Returns 0 on success, -1 if the key is unknown or the value invalid
+ */
+int config_set(struct aesdsocket_config *config, const char *key, const char *value);
+
+/**
+ * Apply every "key = value" line of a config file; '#' starts a comment
+ * Returns 0 on success, -1 on a read or parse error
+ */
+int config_load_file(struct aesdsocket_config *config, const char *path);
+
+/**
+ * Parse the command line, loading the file named by -c/--config first so
+ * that command line options override it, then validate the result
+ * Returns 0 on success, -1 on error (a message has been printed)
+ */
+int config_parse_args(struct aesdsocket_config *config, int argc, char *argv[]);
+
+/**
+ * Resolve the data path for the configured backend
+ */
+const char *config_data_path(const struct aesdsocket_config *config);
+
+/**
+ * Name of a backend as accepted by the "backend" key
+ */
+const char *config_backend_name(enum aesdsocket_backend backend);
+
+/**
+ * Log the effective settings to syslog
+ */
+void config_log(const struct aesdsocket_config *config);
+
+#endif /* AESDSOCKET_CONFIG_H */
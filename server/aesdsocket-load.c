@@ -0,0 +1,411 @@
+/**
+ * aesdsocket-load: load generator and reply latency benchmark for aesdsocket
+ *
+ * Opens connections to a running aesdsocket, each from its own thread, and
+ * pipelines newline terminated lines of a fixed size at a fixed rate, mixing
+ * in AESDCHAR_IOCSEEKTO commands. Every line carries a tag naming its
+ * connection and sequence number; since each reply is the stored history
+ * up to and including the line that caused it, a line counts as answered
+ * when its tag first comes back. Latency runs from the time the line was
+ * due (or sent, when unthrottled) to that moment, so a stalled server is
+ * not hidden by the generator backing off.
+ *
+ * Seek commands are not timed: their reply carries no tag, and backends
+ * without the ioctl (file) send none. Note that every reply repeats the
+ * whole history, so with the file and memory backends reply sizes grow
+ * for the length of the run.
+ *
+ * Usage: aesdsocket-load [-H host] [-p port] [-c connections] [-d seconds] [-l line_len]
+ *                        [-r lines_per_sec] [-P pipeline_depth] [-k seek_percent]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define LOAD_TAG_PREFIX     "@aesdload "
+#define LOAD_TAG_MAX_LEN    48
+#define LOAD_RECV_SIZE      (256 * 1024)
+#define LOAD_DRAIN_SECONDS  5
+
+struct load_config {
+    const char *host;
+    const char *port;
+    int connections;
+    int seconds;
+    size_t line_len;
+    double rate;
+    int depth;
+    int seek_percent;
+};
+
+/**
+ * State and results of one connection
+ */
+struct load_conn {
+    const struct load_config *config;
+    unsigned int id;
+    unsigned int seed;
+    pthread_t thread;
+    uint64_t *latencies;
+    size_t latency_count;
+    size_t latency_capacity;
+    uint64_t lines_sent;
+    uint64_t seeks_sent;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t lost;
+    int failed;
+};
+
+static atomic_int load_stop;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int record_latency(struct load_conn *conn, uint64_t latency) {
+    if (conn->latency_count == conn->latency_capacity) {
+        size_t capacity = conn->latency_capacity ? conn->latency_capacity * 2 : 4096;
+        uint64_t *latencies = realloc(conn->latencies, capacity * sizeof(*latencies));
+        if (latencies == NULL) {
+            return -1;
+        }
+        conn->latencies = latencies;
+        conn->latency_capacity = capacity;
+    }
+    conn->latencies[conn->latency_count++] = latency;
+    return 0;
+}
+
+static int connect_server(const struct load_config *config) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *result;
+    int fd = -1;
+
+    int status = getaddrinfo(config->host, config->port, &hints, &result);
+    if (status != 0) {
+        fprintf(stderr, "%s:%s: %s\n", config->host, config->port, gai_strerror(status));
+        return -1;
+    }
+    for (struct addrinfo *ai = result; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot connect to %s:%s: %s\n", config->host, config->port, strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+/**
+ * Fill line with the next command: a seek, or a tagged line of line_len bytes
+ * Returns the command length
+ */
+static size_t build_command(struct load_conn *conn, char *line, uint64_t seq, int seek) {
+    const struct load_config *config = conn->config;
+
+    if (seek) {
+        return (size_t)snprintf(line, config->line_len + 1, "AESDCHAR_IOCSEEKTO:%u,0\n", (unsigned)(seq % 10));
+    }
+    int len = snprintf(line, config->line_len, LOAD_TAG_PREFIX "%u %llu ", conn->id, (unsigned long long)seq);
+    memset(line + len, 'x', config->line_len - 1 - len);
+    line[config->line_len - 1] = '\n';
+    return config->line_len;
+}
+
+/**
+ * Match the tag at the start of a received line against this connection
+ * Returns the tagged sequence number plus one, or 0 if the line is not ours
+ */
+static uint64_t parse_tag(const struct load_conn *conn, const char *prefix, size_t len) {
+    unsigned int id;
+    unsigned long long seq;
+    char tag[LOAD_TAG_MAX_LEN + 1];
+
+    memcpy(tag, prefix, len);
+    tag[len] = '\0';
+    if (sscanf(tag, LOAD_TAG_PREFIX "%u %llu ", &id, &seq) != 2 || id != conn->id) {
+        return 0;
+    }
+    return seq + 1;
+}
+
+static void *connection_thread(void *args) {
+    struct load_conn *conn = (struct load_conn *)args;
+    const struct load_config *config = conn->config;
+    uint64_t interval = config->rate > 0 ? (uint64_t)(1e9 / config->rate) : 0;
+    uint64_t *due = calloc(config->depth, sizeof(*due));
+    char *line = malloc(config->line_len + 1);
+    char *buf = malloc(LOAD_RECV_SIZE);
+    char tag[LOAD_TAG_MAX_LEN];
+    size_t tag_len = 0;
+    size_t line_off = 0;
+    size_t line_size = 0;
+    uint64_t next_seq = 0;      // Next tagged line to send
+    uint64_t next_answer = 0;   // Oldest tagged line not yet answered
+    uint64_t next_due = now_ns();
+    uint64_t drain_deadline = 0;
+
+    int fd = connect_server(config);
+    if (fd < 0 || due == NULL || line == NULL || buf == NULL) {
+        conn->failed = 1;
+        goto out;
+    }
+
+    for (;;) {
+        uint64_t now = now_ns();
+        int stopping = atomic_load(&load_stop);
+
+        if (stopping && drain_deadline == 0) {
+            drain_deadline = now + LOAD_DRAIN_SECONDS * 1000000000ULL;
+        }
+        if (stopping && ((line_size == 0 && next_answer == next_seq) || now >= drain_deadline)) {
+            conn->lost = next_seq - next_answer;
+            break;
+        }
+
+        // Start the next command once the pipeline has room and it is due
+        if (!stopping && line_size == 0 && next_seq - next_answer < (uint64_t)config->depth &&
+            (interval == 0 || now >= next_due)) {
+            int seek = config->seek_percent > 0 && (int)(rand_r(&conn->seed) % 100) < config->seek_percent;
+            line_size = build_command(conn, line, next_seq, seek);
+            line_off = 0;
+            if (seek) {
+                conn->seeks_sent++;
+            } else {
+                due[next_seq % config->depth] = interval ? next_due : now;
+                next_seq++;
+                conn->lines_sent++;
+            }
+            next_due += interval;
+        }
+
+        int timeout = -1;
+        if (interval && line_size == 0 && !stopping) {
+            timeout = next_due > now ? (int)((next_due - now) / 1000000) : 0;
+        } else if (stopping) {
+            timeout = 100;
+        }
+        struct pollfd pfd = { .fd = fd, .events = POLLIN | (line_size ? POLLOUT : 0) };
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            conn->failed = 1;
+            break;
+        }
+
+        if (pfd.revents & POLLOUT) {
+            ssize_t sent = send(fd, line + line_off, line_size - line_off, MSG_NOSIGNAL);
+            if (sent < 0 && errno != EAGAIN && errno != EINTR) {
+                perror("send");
+                conn->failed = 1;
+                break;
+            }
+            if (sent > 0) {
+                conn->bytes_sent += sent;
+                line_off += sent;
+                if (line_off == line_size) {
+                    line_size = 0;
+                }
+            }
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t received = recv(fd, buf, LOAD_RECV_SIZE, 0);
+            if (received == 0 || (received < 0 && errno != EAGAIN && errno != EINTR)) {
+                fprintf(stderr, "Connection %u closed by server\n", conn->id);
+                conn->failed = 1;
+                break;
+            }
+            now = now_ns();
+            for (ssize_t i = 0; i < received; i++) {
+                if (buf[i] != '\n') {
+                    if (tag_len < sizeof(tag)) {
+                        tag[tag_len++] = buf[i];
+                    }
+                    continue;
+                }
+                // Replies arrive in order, so a newer tag also answers any older line it follows
+                uint64_t answered = parse_tag(conn, tag, tag_len);
+                while (next_answer < answered && next_answer < next_seq) {
+                    if (record_latency(conn, now - due[next_answer % config->depth]) < 0) {
+                        conn->failed = 1;
+                        goto out;
+                    }
+                    next_answer++;
+                }
+                tag_len = 0;
+            }
+            if (received > 0) {
+                conn->bytes_received += received;
+            }
+        }
+    }
+
+out:
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(buf);
+    free(line);
+    free(due);
+    return NULL;
+}
+
+static double percentile_us(const uint64_t *sorted, size_t count, double fraction) {
+    size_t index = (size_t)(count * fraction);
+    return sorted[index < count ? index : count - 1] / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    struct load_config config = {
+        .host = "127.0.0.1",
+        .port = "9000",
+        .connections = 8,
+        .seconds = 10,
+        .line_len = 64,
+        .rate = 0,
+        .depth = 1,
+        .seek_percent = 5,
+    };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:c:d:l:r:P:k:")) != -1) {
+        switch (opt) {
+            case 'H':
+                config.host = optarg;
+                break;
+            case 'p':
+                config.port = optarg;
+                break;
+            case 'c':
+                config.connections = atoi(optarg);
+                break;
+            case 'd':
+                config.seconds = atoi(optarg);
+                break;
+            case 'l':
+                config.line_len = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                config.rate = atof(optarg);
+                break;
+            case 'P':
+                config.depth = atoi(optarg);
+                break;
+            case 'k':
+                config.seek_percent = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr,
+                        "Usage: %s [-H host] [-p port] [-c connections] [-d seconds] [-l line_len]\n"
+                        "       [-r lines_per_sec] [-P pipeline_depth] [-k seek_percent]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (config.connections <= 0 || config.seconds <= 0 || config.depth <= 0 || config.rate < 0 ||
+        config.seek_percent < 0 || config.seek_percent > 100) {
+        fprintf(stderr, "Connections, duration and pipeline depth must be positive, seek percent 0-100\n");
+        return 1;
+    }
+    // Room for the tag and the newline, and for a seek command in place of a line
+    if (config.line_len < LOAD_TAG_MAX_LEN || config.line_len > 1024 * 1024) {
+        fprintf(stderr, "Line length must be between %d and %d bytes\n", LOAD_TAG_MAX_LEN, 1024 * 1024);
+        return 1;
+    }
+
+    struct load_conn *conns = calloc(config.connections, sizeof(*conns));
+    if (conns == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < config.connections; i++) {
+        conns[i].config = &config;
+        conns[i].id = i;
+        conns[i].seed = i + 1;
+        if (pthread_create(&conns[i].thread, NULL, connection_thread, &conns[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    sleep(config.seconds);
+    atomic_store(&load_stop, 1);
+
+    struct load_conn total = {0};
+    for (int i = 0; i < config.connections; i++) {
+        pthread_join(conns[i].thread, NULL);
+        total.lines_sent += conns[i].lines_sent;
+        total.seeks_sent += conns[i].seeks_sent;
+        total.bytes_sent += conns[i].bytes_sent;
+        total.bytes_received += conns[i].bytes_received;
+        total.lost += conns[i].lost;
+        total.failed += conns[i].failed;
+        total.latency_count += conns[i].latency_count;
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    uint64_t *latencies = malloc((total.latency_count ? total.latency_count : 1) * sizeof(*latencies));
+    if (latencies == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    size_t merged = 0;
+    for (int i = 0; i < config.connections; i++) {
+        memcpy(latencies + merged, conns[i].latencies, conns[i].latency_count * sizeof(*latencies));
+        merged += conns[i].latency_count;
+        free(conns[i].latencies);
+    }
+    qsort(latencies, merged, sizeof(*latencies), compare_u64);
+
+    printf("# %s:%s connections=%d seconds=%d line_len=%zu rate=%.0f depth=%d seek_percent=%d\n",
+           config.host, config.port, config.connections, config.seconds, config.line_len, config.rate,
+           config.depth, config.seek_percent);
+    printf("%-12s %10s %10s %10s %10s %10s %10s %10s %10s %8s\n", "lines", "seeks", "lines/s", "tx MiB/s",
+           "rx MiB/s", "p50 us", "p99 us", "p999 us", "max us", "lost");
+    if (merged == 0) {
+        printf("%-12llu %10llu %10.1f %10.2f %10.2f %10s %10s %10s %10s %8llu\n",
+               (unsigned long long)total.lines_sent, (unsigned long long)total.seeks_sent, 0.0,
+               total.bytes_sent / elapsed / (1024.0 * 1024.0), total.bytes_received / elapsed / (1024.0 * 1024.0),
+               "-", "-", "-", "-", (unsigned long long)total.lost);
+    } else {
+        printf("%-12llu %10llu %10.1f %10.2f %10.2f %10.1f %10.1f %10.1f %10.1f %8llu\n",
+               (unsigned long long)total.lines_sent, (unsigned long long)total.seeks_sent, merged / elapsed,
+               total.bytes_sent / elapsed / (1024.0 * 1024.0), total.bytes_received / elapsed / (1024.0 * 1024.0),
+               percentile_us(latencies, merged, 0.50), percentile_us(latencies, merged, 0.99),
+               percentile_us(latencies, merged, 0.999), latencies[merged - 1] / 1000.0,
+               (unsigned long long)total.lost);
+    }
+
+    free(latencies);
+    free(conns);
+    return total.failed ? 1 : 0;
+}
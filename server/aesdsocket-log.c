@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesdsocket-log.h"
+#include "aesdsocket-xfer.h"
+
+static struct aesd_log_segment *segment_alloc(void) {
+    struct aesd_log_segment *segment = malloc(sizeof(struct aesd_log_segment));
+    if (segment != NULL) {
+        atomic_init(&segment->refcount, 1);
+        segment->next = NULL;
+    }
+    return segment;
+}
+
+/**
+ * Drop a reference; freeing a segment drops the reference it holds on its successor
+ */
+static void segment_put(struct aesd_log_segment *segment) {
+    while (segment != NULL && atomic_fetch_sub(&segment->refcount, 1) == 1) {
+        struct aesd_log_segment *next = segment->next;
+        free(segment);
+        segment = next;
+    }
+}
+
+/**
+ * Record the start offset of a new command; log->lock must be held
+ */
+static int push_command_offset(struct aesd_log *log, size_t offset) {
+    if (log->cmd_count == log->cmd_capacity) {
+        size_t capacity = log->cmd_capacity ? log->cmd_capacity * 2 : 64;
+        size_t *offsets = realloc(log->cmd_offsets, capacity * sizeof(size_t));
+        if (offsets == NULL) {
+            return -1;
+        }
+        log->cmd_offsets = offsets;
+        log->cmd_capacity = capacity;
+    }
+    log->cmd_offsets[log->cmd_count++] = offset;
+    return 0;
+}
+
+/**
+ * Initialize an empty log
+ */
+int aesd_log_init(struct aesd_log *log) {
+    memset(log, 0, sizeof(*log));
+    log->head = segment_alloc();
+    if (log->head == NULL) {
+        return -1;
+    }
+    log->tail = log->head;
+    pthread_mutex_init(&log->lock, NULL);
+    return 0;
+}
+
+/**
+ * Drop the log's references; segments still used by snapshots stay alive
+ */
+void aesd_log_destroy(struct aesd_log *log) {
+    segment_put(log->head);
+    free(log->cmd_offsets);
+    pthread_mutex_destroy(&log->lock);
+    memset(log, 0, sizeof(*log));
+}
+
+/**
+ * Index command starts in the concatenation of iov[0..iovcnt) and copy it to the tail;
+ * log->lock must be held
+ * Every segment needed is allocated up front, so a failure leaves the log unchanged
+ */
+static int append_locked(struct aesd_log *log, const struct iovec *iov, int iovcnt) {
+    struct aesd_log_segment *spare = NULL;
+    size_t tail_space = AESD_LOG_SEGMENT_SIZE - log->tail_used;
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    // Chain the new segments; each holds the reference on its successor, as in the log
+    if (len > tail_space) {
+        size_t needed = (len - tail_space + AESD_LOG_SEGMENT_SIZE - 1) / AESD_LOG_SEGMENT_SIZE;
+        struct aesd_log_segment *last = NULL;
+        for (size_t i = 0; i < needed; i++) {
+            struct aesd_log_segment *segment = segment_alloc();
+            if (segment == NULL) {
+                segment_put(spare);
+                return -1;
+            }
+            if (last != NULL) {
+                last->next = segment;
+            } else {
+                spare = segment;
+            }
+            last = segment;
+        }
+    }
+
+    size_t saved_cmd_count = log->cmd_count;
+    int saved_in_command = log->in_command;
+    size_t base = log->length;
+    for (int i = 0; i < iovcnt; i++) {
+        const char *data = iov[i].iov_base;
+        for (size_t pos = 0; pos < iov[i].iov_len; ) {
+            if (!log->in_command) {
+                if (push_command_offset(log, base + pos) < 0) {
+                    log->cmd_count = saved_cmd_count;
+                    log->in_command = saved_in_command;
+                    segment_put(spare);
+                    return -1;
+                }
+                log->in_command = 1;
+            }
+            const char *newline = memchr(data + pos, '\n', iov[i].iov_len - pos);
+            if (newline == NULL) {
+                break;
+            }
+            pos = (newline - data) + 1;
+            log->in_command = 0;
+        }
+        base += iov[i].iov_len;
+    }
+
+    // Nothing can fail from here on
+    for (int i = 0; i < iovcnt; i++) {
+        const char *data = iov[i].iov_base;
+        size_t remaining = iov[i].iov_len;
+        while (remaining > 0) {
+            if (log->tail_used == AESD_LOG_SEGMENT_SIZE) {
+                // The old tail takes over the spare chain's reference on its head
+                log->tail->next = spare;
+                log->tail = spare;
+                log->tail_used = 0;
+                spare = spare->next;
+            }
+
+            size_t chunk = AESD_LOG_SEGMENT_SIZE - log->tail_used;
+            if (chunk > remaining) {
+                chunk = remaining;
+            }
+            memcpy(log->tail->data + log->tail_used, data, chunk);
+            log->tail_used += chunk;
+            log->length += chunk;
+            data += chunk;
+            remaining -= chunk;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Append bytes to the log under the log lock
+ * Returns 0 on success, -1 on allocation failure
+ */
+int aesd_log_append(struct aesd_log *log, const char *data, size_t len) {
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+
+    return aesd_log_appendv(log, &iov, 1);
+}
+
+/**
+ * Append the concatenation of iov[0..iovcnt) to the log under one lock acquisition
+ * Returns 0 on success, -1 on allocation failure, in which case nothing was appended
+ */
+int aesd_log_appendv(struct aesd_log *log, const struct iovec *iov, int iovcnt) {
+    pthread_mutex_lock(&log->lock);
+    int result = append_locked(log, iov, iovcnt);
+    pthread_mutex_unlock(&log->lock);
+
+    return result;
+}
+
+/**
+ * Take a reference on the current contents of the log
+ */
+void aesd_log_snapshot(struct aesd_log *log, struct aesd_log_snapshot *snap) {
+    pthread_mutex_lock(&log->lock);
+    atomic_fetch_add(&log->head->refcount, 1);
+    snap->head = log->head;
+    snap->length = log->length;
+    pthread_mutex_unlock(&log->lock);
+}
+
+/**
+ * Release a snapshot taken with aesd_log_snapshot
+ */
+void aesd_log_snapshot_release(struct aesd_log_snapshot *snap) {
+    segment_put(snap->head);
+    snap->head = NULL;
+    snap->length = 0;
+}
+
+/**
+ * Translate a (write_cmd, write_cmd_offset) pair into a byte offset within snap
+ * Returns 0 on success, -1 if the command or offset does not exist
+ */
+int aesd_log_command_offset(struct aesd_log *log, const struct aesd_log_snapshot *snap,
+                            uint32_t write_cmd, uint32_t write_cmd_offset, size_t *offset) {
+    int result = -1;
+
+    pthread_mutex_lock(&log->lock);
+    if (write_cmd < log->cmd_count && log->cmd_offsets[write_cmd] < snap->length) {
+        size_t start = log->cmd_offsets[write_cmd];
+        size_t end = snap->length;
+        if (write_cmd + 1 < log->cmd_count && log->cmd_offsets[write_cmd + 1] < end) {
+            end = log->cmd_offsets[write_cmd + 1];
+        }
+        if (write_cmd_offset < end - start) {
+            *offset = start + write_cmd_offset;
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    return result;
+}
+
+/**
+ * Send the snapshot contents from offset to the end to connection_fd
+ * Returns the number of bytes sent, or -1 on error
+ */
+ssize_t aesd_log_send(const struct aesd_log_snapshot *snap, size_t offset, int connection_fd) {
+    const struct aesd_log_segment *segment = snap->head;
+    size_t segment_start = 0;
+    ssize_t total = 0;
+
+    // Only bytes below snap->length are read, and those are never rewritten
+    while (segment != NULL && segment_start < snap->length) {
+        size_t segment_end = segment_start + AESD_LOG_SEGMENT_SIZE;
+        if (segment_end > snap->length) {
+            segment_end = snap->length;
+        }
+        if (offset < segment_end) {
+            size_t from = offset > segment_start ? offset - segment_start : 0;
+            size_t len = segment_end - segment_start - from;
+            if (send_all(connection_fd, segment->data + from, len) < 0) {
+                return -1;
+            }
+            total += len;
+        }
+        segment_start += AESD_LOG_SEGMENT_SIZE;
+        segment = segment->next;
+    }
+
+    return total;
+}
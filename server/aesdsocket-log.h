@@ -0,0 +1,104 @@
+#ifndef AESDSOCKET_LOG_H
+#define AESDSOCKET_LOG_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * Bytes held by each log segment
+ */
+#define AESD_LOG_SEGMENT_SIZE (64 * 1024)
+
+/**
+ * A fixed-size chunk of log data. Bytes below the log length are never
+ * modified again, so readers may access them without the log lock.
+ * Each segment holds one reference on its successor.
+ */
+struct aesd_log_segment {
+    atomic_int refcount;
+    struct aesd_log_segment *next;
+    char data[AESD_LOG_SEGMENT_SIZE];
+};
+
+/**
+ * In-process append-only log used as the in-memory storage backend
+ */
+struct aesd_log {
+    /**
+     * Protects the tail, the length and the command index; held only while appending
+     */
+    pthread_mutex_t lock;
+    struct aesd_log_segment *head;
+    struct aesd_log_segment *tail;
+    size_t tail_used;
+    size_t length;
+    /**
+     * Start offset of every newline terminated command, used for seek commands
+     */
+    size_t *cmd_offsets;
+    size_t cmd_count;
+    size_t cmd_capacity;
+    /**
+     * Set when the last append did not end with a newline
+     */
+    int in_command;
+};
+
+/**
+ * An immutable view of the first length bytes of the log
+ */
+struct aesd_log_snapshot {
+    struct aesd_log_segment *head;
+    size_t length;
+};
+
+/**
+ * Initialize an empty log
+ */
+int aesd_log_init(struct aesd_log *log);
+
+/**
+ * Drop the log's references; segments still used by snapshots stay alive
+ */
+void aesd_log_destroy(struct aesd_log *log);
+
+/**
+ * Append bytes to the log under the log lock
+ * Returns 0 on success, -1 on allocation failure
+ */
+int aesd_log_append(struct aesd_log *log, const char *data, size_t len);
+
+/**
+ * Append the concatenation of iov[0..iovcnt) to the log under one lock acquisition
+ * Returns 0 on success, -1 on allocation failure, in which case nothing was appended
+ */
+int aesd_log_appendv(struct aesd_log *log, const struct iovec *iov, int iovcnt);
+
+/**
+ * Take a reference on the current contents of the log
+ */
+void aesd_log_snapshot(struct aesd_log *log, struct aesd_log_snapshot *snap);
+
+/**
+ * Release a snapshot taken with aesd_log_snapshot
+ */
+void aesd_log_snapshot_release(struct aesd_log_snapshot *snap);
+
+/**
+ * Translate a (write_cmd, write_cmd_offset) pair into a byte offset within snap
+ * Returns 0 on success, -1 if the command or offset does not exist
+ */
+int aesd_log_command_offset(struct aesd_log *log, const struct aesd_log_snapshot *snap,
+                            uint32_t write_cmd, uint32_t write_cmd_offset, size_t *offset);
+
+/**
+ * Send the snapshot contents from offset to the end to connection_fd
+ * Returns the number of bytes sent, or -1 on error
+ */
+ssize_t aesd_log_send(const struct aesd_log_snapshot *snap, size_t offset, int connection_fd);
+
+#endif /* AESDSOCKET_LOG_H */
@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesdsocket-rxbuf.h"
+#include "aesd-scan.h"
+
+/**
+ * Double the ring, copying the buffered bytes to the start of the new storage
+ */
+static int rxbuf_grow(struct rxbuf *rx) {
+    size_t capacity = rx->capacity ? rx->capacity * 2 : rx->initial_capacity;
+    size_t used = rx->tail - rx->head;
+    char *data = malloc(capacity);
+
+    if (data == NULL) {
+        return -1;
+    }
+
+    if (used > 0) {
+        size_t mask = rx->capacity - 1;
+        size_t start = rx->head & mask;
+        size_t first = rx->capacity - start;
+        if (first > used) {
+            first = used;
+        }
+        memcpy(data, rx->data + start, first);
+        memcpy(data + first, rx->data, used - first);
+    }
+
+    free(rx->data);
+    rx->data = data;
+    rx->capacity = capacity;
+    for (size_t i = rx->newline_next; i < rx->newline_count; i++) {
+        rx->newlines[i] -= rx->head;
+    }
+    rx->scan -= rx->head;
+    rx->tail = used;
+    rx->head = 0;
+    return 0;
+}
+
+/**
+ * Initialize an empty ring; initial_capacity bytes (a power of two) are
+ * allocated on first receive
+ */
+void rxbuf_init(struct rxbuf *rx, size_t initial_capacity, size_t max_line) {
+    memset(rx, 0, sizeof(*rx));
+    rx->initial_capacity = initial_capacity;
+    rx->max_line = max_line;
+}
+
+/**
+ * Release the ring storage
+ */
+void rxbuf_free(struct rxbuf *rx) {
+    free(rx->data);
+    rx->data = NULL;
+    rx->capacity = 0;
+}
+
+/**
+ * Receive into the free space of the ring with a single readv()
+ * Returns bytes received, 0 at end of stream, or -1 with errno set
+ * (EMSGSIZE when a line exceeds max_line, ENOMEM when the ring cannot grow)
+ */
+ssize_t rxbuf_recv(struct rxbuf *rx, int connection_fd) {
+    size_t used = rx->tail - rx->head;
+
+    // Everything still buffered is one partial line, complete lines were consumed
+    if (used > rx->max_line) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if (used == rx->capacity && rxbuf_grow(rx) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t mask = rx->capacity - 1;
+    size_t start = rx->tail & mask;
+    size_t space = rx->capacity - used;
+    struct iovec iov[2];
+    int iovcnt = 1;
+
+    iov[0].iov_base = rx->data + start;
+    iov[0].iov_len = rx->capacity - start < space ? rx->capacity - start : space;
+    if (iov[0].iov_len < space) {
+        iov[1].iov_base = rx->data;
+        iov[1].iov_len = space - iov[0].iov_len;
+        iovcnt = 2;
+    }
+
+    ssize_t received = readv(connection_fd, iov, iovcnt);
+    if (received > 0) {
+        rx->tail += received;
+    }
+    return received;
+}
+
+/**
+ * Frame and consume the next complete line
+ * Fills line[] with one or two iovecs (two when the line wraps the ring)
+ * which stay valid until the next rxbuf_recv
+ * Returns the number of iovecs, or 0 if no complete line is buffered
+ */
+int rxbuf_next_line(struct rxbuf *rx, struct iovec line[2]) {
+    size_t mask = rx->capacity - 1;
+
+    // Refill the newline queue, resuming the scan where the previous pass stopped
+    while (rx->newline_next == rx->newline_count && rx->scan < rx->tail) {
+        size_t start = rx->scan & mask;
+        size_t run = rx->capacity - start;
+        size_t offsets[RXBUF_SCAN_BATCH];
+        size_t scanned;
+        if (run > rx->tail - rx->scan) {
+            run = rx->tail - rx->scan;
+        }
+
+        size_t found = aesd_scan_newlines(rx->data + start, run, offsets, RXBUF_SCAN_BATCH, &scanned);
+        for (size_t i = 0; i < found; i++) {
+            rx->newlines[i] = rx->scan + offsets[i];
+        }
+        rx->newline_next = 0;
+        rx->newline_count = found;
+        rx->scan += scanned;
+    }
+
+    if (rx->newline_next == rx->newline_count) {
+        return 0;
+    }
+
+    size_t end = rx->newlines[rx->newline_next++] + 1;
+    size_t head_pos = rx->head & mask;
+    size_t len = end - rx->head;
+    int iovcnt = 1;
+
+    line[0].iov_base = rx->data + head_pos;
+    line[0].iov_len = len;
+    if (head_pos + len > rx->capacity) {
+        line[0].iov_len = rx->capacity - head_pos;
+        line[1].iov_base = rx->data;
+        line[1].iov_len = len - line[0].iov_len;
+        iovcnt = 2;
+    }
+
+    rx->head = end;
+    if (rx->head == rx->tail) {
+        // Empty ring: restart at offset 0 so the next lines stay contiguous
+        rx->head = rx->scan = rx->tail = 0;
+        rx->newline_next = rx->newline_count = 0;
+    }
+    return iovcnt;
+}
@@ -0,0 +1,72 @@
+#ifndef AESDSOCKET_RXBUF_H
+#define AESDSOCKET_RXBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * Default initial ring capacity; must be a power of two
+ */
+#define RXBUF_INITIAL_CAPACITY 4096
+
+/**
+ * Default limit on the length of a single newline terminated line
+ */
+#define RXBUF_DEFAULT_MAX_LINE (1024 * 1024)
+
+/**
+ * Number of newline positions remembered from one scan pass
+ */
+#define RXBUF_SCAN_BATCH 64
+
+/**
+ * Growable per-connection receive ring.
+ * head, scan and tail are free-running byte counters masked by capacity - 1:
+ * bytes in [head, tail) are buffered and [scan, tail) has not been scanned yet.
+ * Every newline found in [head, scan) is queued in newlines[], so one vector
+ * scan pass frames a whole burst of pipelined lines.
+ * Lines are framed in place and handed out as at most two iovecs, so no data
+ * is ever shifted. The ring only reallocates while growing towards the
+ * longest line seen, so a warmed up connection receives without allocating.
+ */
+struct rxbuf {
+    char *data;
+    size_t capacity;
+    size_t initial_capacity;
+    size_t head;
+    size_t scan;
+    size_t tail;
+    size_t max_line;
+    size_t newlines[RXBUF_SCAN_BATCH];
+    size_t newline_next;
+    size_t newline_count;
+};
+
+/**
+ * Initialize an empty ring; initial_capacity bytes (a power of two) are
+ * allocated on first receive
+ */
+void rxbuf_init(struct rxbuf *rx, size_t initial_capacity, size_t max_line);
+
+/**
+ * Release the ring storage
+ */
+void rxbuf_free(struct rxbuf *rx);
+
+/**
+ * Receive into the free space of the ring with a single readv()
+ * Returns bytes received, 0 at end of stream, or -1 with errno set
+ * (EMSGSIZE when a line exceeds max_line, ENOMEM when the ring cannot grow)
+ */
+ssize_t rxbuf_recv(struct rxbuf *rx, int connection_fd);
+
+/**
+ * Frame and consume the next complete line
+ * Fills line[] with one or two iovecs (two when the line wraps the ring)
+ * which stay valid until the next rxbuf_recv
+ * Returns the number of iovecs, or 0 if no complete line is buffered
+ */
+int rxbuf_next_line(struct rxbuf *rx, struct iovec line[2]);
+
+#endif /* AESDSOCKET_RXBUF_H */
@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
+#include "aesdsocket-txq.h"
+
+#define TXQ_CHUNK_SIZE (64 * 1024)
+
+static void reply_free(struct txq_reply *reply) {
+    if (reply->kind == TXQ_BUFFER) {
+        free(reply->data);
+    } else if (reply->kind == TXQ_LOG) {
+        aesd_log_snapshot_release(&reply->snap);
+    }
+    free(reply);
+}
+
+static void push_reply(struct txq *q, struct txq_reply *reply) {
+    reply->next = NULL;
+    if (q->tail != NULL) {
+        q->tail->next = reply;
+    } else {
+        q->head = reply;
+    }
+    q->tail = reply;
+}
+
+/**
+ * Initialize an empty queue
+ */
+void txq_init(struct txq *q) {
+    q->head = NULL;
+    q->tail = NULL;
+    q->file_fd = -1;
+}
+
+/**
+ * Drop every queued reply and close the queue's data file descriptor
+ */
+void txq_free(struct txq *q) {
+    while (q->head != NULL) {
+        struct txq_reply *reply = q->head;
+        q->head = reply->next;
+        reply_free(reply);
+    }
+    q->tail = NULL;
+    if (q->file_fd >= 0) {
+        close(q->file_fd);
+        q->file_fd = -1;
+    }
+}
+
+/**
+ * Check whether any reply is still waiting to be sent
+ */
+int txq_pending(const struct txq *q) {
+    return q->head != NULL;
+}
+
+/**
+ * Queue len bytes of data, taking ownership of the malloc'd buffer
+ * Returns 0 on success, -1 on allocation failure (data is freed)
+ */
+int txq_push_buffer(struct txq *q, char *data, size_t len) {
+    struct txq_reply *reply = calloc(1, sizeof(*reply));
+    if (reply == NULL) {
+        free(data);
+        return -1;
+    }
+    reply->kind = TXQ_BUFFER;
+    reply->data = data;
+    reply->end = len;
+    push_reply(q, reply);
+    return 0;
+}
+
+/**
+ * Queue the bytes [0, end) of the data file open as fd; fd is duplicated on first use
+ * Returns 0 on success, -1 on error
+ */
+int txq_push_file(struct txq *q, int fd, size_t end) {
+    // Bytes below end are never rewritten, so any descriptor of the file can send them later
+    if (q->file_fd < 0) {
+        q->file_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (q->file_fd < 0) {
+            return -1;
+        }
+    }
+
+    struct txq_reply *reply = calloc(1, sizeof(*reply));
+    if (reply == NULL) {
+        return -1;
+    }
+    reply->kind = TXQ_FILE;
+    reply->end = end;
+    push_reply(q, reply);
+    return 0;
+}
+
+/**
+ * Queue the snapshot from offset to its end, taking ownership of the snapshot
+ * Returns 0 on success, -1 on allocation failure (the snapshot is released)
+ */
+int txq_push_log(struct txq *q, struct aesd_log_snapshot *snap, size_t offset) {
+    struct txq_reply *reply = calloc(1, sizeof(*reply));
+    if (reply == NULL) {
+        aesd_log_snapshot_release(snap);
+        return -1;
+    }
+    reply->kind = TXQ_LOG;
+    reply->snap = *snap;
+    reply->offset = offset;
+    reply->end = snap->length;
+    push_reply(q, reply);
+    return 0;
+}
+
+/**
+ * Send part of a file reply without blocking
+ */
+static ssize_t send_file_part(int file_fd, struct txq_reply *reply, int connection_fd) {
+    size_t len = reply->end - reply->offset;
+    off_t offset = (off_t)reply->offset;
+
+    ssize_t sent = sendfile(connection_fd, file_fd, &offset, len < TXQ_CHUNK_SIZE ? len : TXQ_CHUNK_SIZE);
+    if (sent >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+        return sent;
+    }
+
+    // No sendfile for this file, bounce through a buffer; only what the socket took counts
+    char buffer[TXQ_CHUNK_SIZE];
+    ssize_t bytes_read = pread(file_fd, buffer, len < sizeof(buffer) ? len : sizeof(buffer), reply->offset);
+    if (bytes_read <= 0) {
+        if (bytes_read == 0) {
+            errno = EIO;
+        }
+        return -1;
+    }
+    return send(connection_fd, buffer, (size_t)bytes_read, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+/**
+ * Send part of a log snapshot reply without blocking
+ */
+static ssize_t send_log_part(struct txq_reply *reply, int connection_fd) {
+    const struct aesd_log_segment *segment = reply->snap.head;
+    size_t segment_start = 0;
+
+    while (segment_start + AESD_LOG_SEGMENT_SIZE <= reply->offset) {
+        segment = segment->next;
+        segment_start += AESD_LOG_SEGMENT_SIZE;
+    }
+    size_t from = reply->offset - segment_start;
+    size_t len = AESD_LOG_SEGMENT_SIZE - from;
+    if (len > reply->end - reply->offset) {
+        len = reply->end - reply->offset;
+    }
+    return send(connection_fd, segment->data + from, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+/**
+ * Send queued replies until the queue is empty or the socket would block
+ * Returns 1 once the queue is empty, 0 if the socket is full, -1 on error
+ */
+int txq_flush(struct txq *q, int connection_fd) {
+    while (q->head != NULL) {
+        struct txq_reply *reply = q->head;
+
+        if (reply->offset == reply->end) {
+            q->head = reply->next;
+            if (q->head == NULL) {
+                q->tail = NULL;
+            }
+            reply_free(reply);
+            continue;
+        }
+
+        ssize_t sent;
+        switch (reply->kind) {
+            case TXQ_FILE:
+                sent = send_file_part(q->file_fd, reply, connection_fd);
+                break;
+            case TXQ_LOG:
+                sent = send_log_part(reply, connection_fd);
+                break;
+            case TXQ_BUFFER:
+            default:
+                sent = send(connection_fd, reply->data + reply->offset, reply->end - reply->offset,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+                break;
+        }
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        if (sent == 0) {
+            errno = EIO;
+            return -1;
+        }
+        reply->offset += (size_t)sent;
+    }
+    return 1;
+}
@@ -0,0 +1,86 @@
+#ifndef AESDSOCKET_TXQ_H
+#define AESDSOCKET_TXQ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "aesdsocket-log.h"
+
+/**
+ * Source of the bytes of one queued reply
+ */
+enum txq_kind {
+    TXQ_BUFFER,     /* A heap copy owned by the reply */
+    TXQ_FILE,       /* A byte range of the queue's data file, which only grows */
+    TXQ_LOG,        /* A range of an in-memory log snapshot */
+};
+
+/**
+ * A reply captured when its packet was processed, sent as the socket drains
+ */
+struct txq_reply {
+    struct txq_reply *next;
+    enum txq_kind kind;
+    /**
+     * Next byte to send and one past the last one, in the source's offsets
+     */
+    size_t offset;
+    size_t end;
+    char *data;
+    struct aesd_log_snapshot snap;
+};
+
+/**
+ * Per-connection queue of replies waiting for a non-blocking socket.
+ * Replies are captured under whatever lock the backend needs and sent
+ * later without it, so a client that stops reading only stalls itself.
+ */
+struct txq {
+    struct txq_reply *head;
+    struct txq_reply *tail;
+    /**
+     * Private descriptor of the data file for TXQ_FILE replies, -1 until needed
+     */
+    int file_fd;
+};
+
+/**
+ * Initialize an empty queue
+ */
+void txq_init(struct txq *q);
+
+/**
+ * Drop every queued reply and close the queue's data file descriptor
+ */
+void txq_free(struct txq *q);
+
+/**
+ * Check whether any reply is still waiting to be sent
+ */
+int txq_pending(const struct txq *q);
+
+/**
+ * Queue len bytes of data, taking ownership of the malloc'd buffer
+ * Returns 0 on success, -1 on allocation failure (data is freed)
+ */
+int txq_push_buffer(struct txq *q, char *data, size_t len);
+
+/**
+ * Queue the bytes [0, end) of the data file open as fd; fd is duplicated on first use
+ * Returns 0 on success, -1 on error
+ */
+int txq_push_file(struct txq *q, int fd, size_t end);
+
+/**
+ * Queue the snapshot from offset to its end, taking ownership of the snapshot
+ * Returns 0 on success, -1 on allocation failure (the snapshot is released)
+ */
+int txq_push_log(struct txq *q, struct aesd_log_snapshot *snap, size_t offset);
+
+/**
+ * Send queued replies until the queue is empty or the socket would block
+ * Returns 1 once the queue is empty, 0 if the socket is full, -1 on error
+ */
+int txq_flush(struct txq *q, int connection_fd);
+
+#endif /* AESDSOCKET_TXQ_H */
@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "aesdsocket-xfer.h"
+
+#define XFER_CHUNK_SIZE     (64 * 1024)
+#define XFER_UNSUPPORTED    (-2)
+
+// Per-thread pipe used as the splice intermediary, closed at thread exit
+static pthread_key_t splice_pipe_key;
+static pthread_once_t splice_pipe_once = PTHREAD_ONCE_INIT;
+
+static void splice_pipe_destroy(void *value) {
+    int *pipe_fds = (int *)value;
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    free(pipe_fds);
+}
+
+static void splice_pipe_key_create(void) {
+    pthread_key_create(&splice_pipe_key, splice_pipe_destroy);
+}
+
+/**
+ * Get (creating on first use) the calling thread's splice pipe
+ */
+static int *splice_pipe_get(void) {
+    pthread_once(&splice_pipe_once, splice_pipe_key_create);
+
+    int *pipe_fds = pthread_getspecific(splice_pipe_key);
+    if (pipe_fds != NULL) {
+        return pipe_fds;
+    }
+
+    pipe_fds = malloc(2 * sizeof(int));
+    if (pipe_fds == NULL) {
+        return NULL;
+    }
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        free(pipe_fds);
+        return NULL;
+    }
+    pthread_setspecific(splice_pipe_key, pipe_fds);
+    return pipe_fds;
+}
+
+/**
+ * Discard the calling thread's splice pipe after an error left data in it
+ */
+static void splice_pipe_reset(void) {
+    int *pipe_fds = pthread_getspecific(splice_pipe_key);
+    if (pipe_fds != NULL) {
+        pthread_setspecific(splice_pipe_key, NULL);
+        splice_pipe_destroy(pipe_fds);
+    }
+}
+
+/**
+ * Block until a non-blocking socket can accept more data
+ */
+static int wait_writable(int connection_fd) {
+    struct pollfd pfd = { .fd = connection_fd, .events = POLLOUT };
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Send a whole buffer, handling partial sends and non-blocking sockets
+ */
+int send_all(int connection_fd, const char *buffer, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(connection_fd, buffer, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Socket buffer is full, wait until the client drains it
+                if (wait_writable(connection_fd) < 0) {
+                    return -1;
+                }
+                continue;
+            }
+            return -1;
+        }
+        buffer += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+/**
+ * Write every byte described by iov, resuming after short writes
+ * Returns 0 on success, -1 on error
+ */
+int writev_all(int fd, const struct iovec *iov, int iovcnt) {
+    struct iovec partial;
+
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (written == 0 && iov->iov_len > 0) {
+            // No progress is possible, fail instead of retrying forever
+            errno = EIO;
+            return -1;
+        }
+
+        // Skip fully written iovecs, then resume inside the partially written one
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0 && written > 0) {
+            // Finish the partially written iovec on its own, then continue with the rest
+            partial.iov_base = (char *)iov->iov_base + written;
+            partial.iov_len = iov->iov_len - written;
+            if (writev_all(fd, &partial, 1) < 0) {
+                return -1;
+            }
+            iov++;
+            iovcnt--;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Read in_fd to end of file into a malloc'd buffer returned in *data_rtn
+ * If offset is NULL the file position is used and advanced, otherwise reading
+ * starts at *offset and the file position is untouched
+ * Returns 0 on success, -1 on error
+ */
+int xfer_read_all(int in_fd, off_t *offset, char **data_rtn, size_t *len_rtn) {
+    size_t capacity = XFER_CHUNK_SIZE;
+    size_t len = 0;
+    char *data = malloc(capacity);
+
+    if (data == NULL) {
+        return -1;
+    }
+    for (;;) {
+        if (len == capacity) {
+            char *grown = realloc(data, capacity * 2);
+            if (grown == NULL) {
+                free(data);
+                return -1;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        ssize_t bytes_read = offset != NULL ? pread(in_fd, data + len, capacity - len, *offset + len)
+                                            : read(in_fd, data + len, capacity - len);
+        if (bytes_read == 0) {
+            break;
+        }
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syslog(LOG_ERR, "Error reading data file: %s", strerror(errno));
+            free(data);
+            return -1;
+        }
+        len += (size_t)bytes_read;
+    }
+
+    *data_rtn = data;
+    *len_rtn = len;
+    return 0;
+}
+
+/**
+ * Copy path: read into a bounce buffer and send each chunk
+ */
+static ssize_t xfer_copy(int in_fd, off_t *offset, int connection_fd) {
+    char read_buffer[XFER_COPY_BUFFER_SIZE];
+    ssize_t bytes_read;
+    ssize_t total = 0;
+
+    while ((bytes_read = offset != NULL ? pread(in_fd, read_buffer, sizeof(read_buffer), *offset)
+                                        : read(in_fd, read_buffer, sizeof(read_buffer))) != 0) {
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syslog(LOG_ERR, "Error reading data file: %s", strerror(errno));
+            return -1;
+        }
+        if (send_all(connection_fd, read_buffer, bytes_read) < 0) {
+            syslog(LOG_ERR, "Error sending data to client: %s", strerror(errno));
+            return -1;
+        }
+        if (offset != NULL) {
+            *offset += bytes_read;
+        }
+        total += bytes_read;
+    }
+
+    return total;
+}
+
+/**
+ * sendfile path: the kernel copies page cache pages straight to the socket
+ * Returns XFER_UNSUPPORTED if nothing was sent and the file cannot be used
+ */
+static ssize_t xfer_sendfile(int in_fd, off_t *offset, int connection_fd) {
+    ssize_t total = 0;
+
+    for (;;) {
+        // sendfile advances *offset itself when one is given
+        ssize_t sent = sendfile(connection_fd, in_fd, offset, XFER_CHUNK_SIZE);
+        if (sent > 0) {
+            total += sent;
+            continue;
+        }
+        if (sent == 0) {
+            return total;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (wait_writable(connection_fd) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            return XFER_UNSUPPORTED;
+        }
+        syslog(LOG_ERR, "Error in sendfile to client: %s", strerror(errno));
+        return -1;
+    }
+}
+
+/**
+ * splice path: move data file -> pipe -> socket without a user space copy
+ * Returns XFER_UNSUPPORTED if nothing was sent and the file cannot be spliced
+ */
+static ssize_t xfer_splice(int in_fd, off_t *offset, int connection_fd) {
+    int *pipe_fds = splice_pipe_get();
+    loff_t splice_offset = offset != NULL ? *offset : 0;
+    ssize_t total = 0;
+
+    if (pipe_fds == NULL) {
+        return XFER_UNSUPPORTED;
+    }
+
+    for (;;) {
+        ssize_t in_pipe = splice(in_fd, offset != NULL ? &splice_offset : NULL, pipe_fds[1], NULL,
+                                 XFER_CHUNK_SIZE, SPLICE_F_MOVE);
+        if (in_pipe == 0) {
+            return total;
+        }
+        if (in_pipe < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                return XFER_UNSUPPORTED;
+            }
+            syslog(LOG_ERR, "Error splicing data file: %s", strerror(errno));
+            return -1;
+        }
+        if (offset != NULL) {
+            *offset = splice_offset;
+        }
+
+        while (in_pipe > 0) {
+            // No SPLICE_F_MORE: the final chunk must not be held back by TCP corking
+            ssize_t sent = splice(pipe_fds[0], NULL, connection_fd, NULL, in_pipe, SPLICE_F_MOVE);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (wait_writable(connection_fd) < 0) {
+                        splice_pipe_reset();
+                        return -1;
+                    }
+                    continue;
+                }
+                syslog(LOG_ERR, "Error splicing data to client: %s", strerror(errno));
+                splice_pipe_reset();
+                return -1;
+            }
+            in_pipe -= sent;
+            total += sent;
+        }
+    }
+}
+
+/**
+ * Stream in_fd to end of file into connection_fd
+ * If offset is NULL the file position is used and advanced, otherwise the
+ * transfer starts at *offset (positional I/O, the file position is untouched)
+ * and *offset is advanced by the bytes sent
+ * Returns the number of bytes sent, or -1 on error
+ */
+ssize_t xfer_stream_to_socket(int in_fd, off_t *offset, int connection_fd, enum xfer_mode mode) {
+    ssize_t result;
+    struct stat st;
+
+    switch (mode) {
+        case XFER_COPY:
+            return xfer_copy(in_fd, offset, connection_fd);
+        case XFER_SENDFILE:
+            result = xfer_sendfile(in_fd, offset, connection_fd);
+            return result == XFER_UNSUPPORTED ? -1 : result;
+        case XFER_SPLICE:
+            result = xfer_splice(in_fd, offset, connection_fd);
+            return result == XFER_UNSUPPORTED ? -1 : result;
+        case XFER_AUTO:
+        default:
+            break;
+    }
+
+    // Regular files go through sendfile, the char device through splice
+    if (fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        result = xfer_sendfile(in_fd, offset, connection_fd);
+    } else {
+        result = xfer_splice(in_fd, offset, connection_fd);
+    }
+
+    if (result == XFER_UNSUPPORTED) {
+        result = xfer_copy(in_fd, offset, connection_fd);
+    }
+    return result;
+}
@@ -0,0 +1,51 @@
+#ifndef AESDSOCKET_XFER_H
+#define AESDSOCKET_XFER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * Size of the bounce buffer used by the read/send copy path
+ */
+#define XFER_COPY_BUFFER_SIZE 1024
+
+/**
+ * Strategy used to move bytes from a file descriptor to a socket
+ */
+enum xfer_mode {
+    XFER_AUTO,      /* sendfile for regular files, splice otherwise, copy as fallback */
+    XFER_COPY,      /* read() into a bounce buffer and send() each chunk */
+    XFER_SENDFILE,  /* sendfile() only */
+    XFER_SPLICE,    /* splice() through a per-thread pipe only */
+};
+
+/**
+ * Send a whole buffer, handling partial sends and non-blocking sockets
+ */
+int send_all(int connection_fd, const char *buffer, size_t len);
+
+/**
+ * Write every byte described by iov, resuming after short writes
+ * Returns 0 on success, -1 on error
+ */
+int writev_all(int fd, const struct iovec *iov, int iovcnt);
+
+/**
+ * Stream in_fd to end of file into connection_fd
+ * If offset is NULL the file position is used and advanced, otherwise the
+ * transfer starts at *offset (positional I/O, the file position is untouched)
+ * and *offset is advanced by the bytes sent
+ * Returns the number of bytes sent, or -1 on error
+ */
+ssize_t xfer_stream_to_socket(int in_fd, off_t *offset, int connection_fd, enum xfer_mode mode);
+
+/**
+ * Read in_fd to end of file into a malloc'd buffer returned in *data_rtn
+ * If offset is NULL the file position is used and advanced, otherwise reading
+ * starts at *offset and the file position is untouched
+ * Returns 0 on success, -1 on error
+ */
+int xfer_read_all(int in_fd, off_t *offset, char **data_rtn, size_t *len_rtn);
+
+#endif /* AESDSOCKET_XFER_H */
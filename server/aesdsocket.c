@@ -13,85 +13,206 @@
 #include <pthread.h>
 #include <time.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
 
 #include "aesdsocket.h"
+#include "aesdsocket-config.h"
+#include "aesdsocket-xfer.h"
+#include "aesdsocket-log.h"
+#include "aesdsocket-rxbuf.h"
+#include "aesdsocket-txq.h"
 #include "../aesd-char-driver/aesd_ioctl.h"
+#include "../aesd-char-driver/aesd-emu.h"
 
-#define PORT        9000
-#define BACKLOG     10
-#define BUFFER_SIZE 1024
-#define USE_AESD_CHAR_DEVICE 1
-#if USE_AESD_CHAR_DEVICE
-#define DATA_FILE   "/dev/aesdchar"
-#define OPEN_FLAGS  (O_WRONLY | O_APPEND)
-#define OPEN_MODE   0
-#else
-#define DATA_FILE   "/var/tmp/aesdsocketdata"
-#define OPEN_FLAGS  (O_CREAT | O_WRONLY | O_APPEND)
-#define OPEN_MODE   0644
-#endif
+#define DATA_FILE_MODE 0644
 #define TIMESTAMP_INTERVAL 10
+#define EVENT_LOOP_MAX_EVENTS   64
+#define EVENT_LOOP_TIMEOUT_MS   1000
+#define EVENT_LOOP_READ_BUDGET  16
+#define QUEUE_WAIT_TIMEOUT_SEC  1
+#define SEEK_COMMAND_MAX_LEN    128
+#define SEEK_COMMAND_PREFIX     "AESDCHAR_IOCSEEKTO:"
+#define BATCH_MAX_IOV           256
+#define EMU_SEND_CHUNK          4096
 
-static int daemon_mode = 0;
 static int socket_fd = -1;
 static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
 static volatile sig_atomic_t shutdown_requested = 0;
 static pthread_t timer_thread_id;
 static int timer_thread_created = 0;
 
-// Structure to hold thread list node
+// Long-lived data file descriptors shared by all connections, guarded by file_mutex
+static int data_write_fd = -1;
+static int data_read_fd = -1;
+// Data path counters, reported at shutdown
+static unsigned long data_file_opens = 0;
+static unsigned long packets_written = 0;
+
+// Cleared once the char device turns out not to support AESDCHAR_IOCAPPENDV, guarded by file_mutex
+static int chardev_appendv_supported = 1;
+
+// Emulated aesdchar device and the one file every connection writes through, used by the emu
+// backend; emu_file is guarded by file_mutex
+static struct aesd_emu emu_device;
+static struct aesd_emu_file emu_file;
+
+// In-memory append log, used by the memory backend
+static struct aesd_log memory_log;
+
+// Structure to hold connection data for thread
+typedef struct {
+    int connection_fd;
+    struct sockaddr_in client_addr;
+    const struct aesdsocket_config *config;
+} thread_args_t;
+
+// Intrusive list node for a connection thread; also serves as its argument
 typedef struct thread_node {
     pthread_t thread_id;
+    thread_args_t args;
+    struct thread_node *prev;
     struct thread_node *next;
 } thread_node_t;
 
-// Thread list management
+// Thread list management: running threads, and finished threads awaiting join
 static thread_node_t *thread_list_head = NULL;
+static thread_node_t *thread_list_tail = NULL;
+static thread_node_t *reap_list_head = NULL;
+static thread_node_t *reap_list_tail = NULL;
 static pthread_mutex_t thread_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reap_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t thread_list_empty_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t reaper_thread_id;
+static int reaper_thread_created = 0;
+static int reaper_stop = 0;
+static unsigned long threads_reaped = 0;
+
+// Per-connection state owned by an event loop thread
+typedef struct connection {
+    int connection_fd;
+    struct rxbuf rx;
+    // Replies not yet accepted by the socket; while any are queued the loop waits for EPOLLOUT
+    struct txq txq;
+    char client_ip[INET_ADDRSTRLEN];
+    struct connection *prev;
+    struct connection *next;
+} connection_t;
 
-// Structure to hold connection data for thread
+// Event loop (reactor) thread state
 typedef struct {
-    int connection_fd;
-    struct sockaddr_in client_addr;
-} thread_args_t;
+    int epoll_fd;
+    pthread_t thread_id;
+    pthread_mutex_t lock;
+    connection_t *connections;
+    const struct aesdsocket_config *config;
+} event_loop_t;
+
+static event_loop_t *event_loops = NULL;
+static int event_loops_started = 0;
+static unsigned int next_event_loop = 0;
+
+// Bounded MPMC queue of accepted connections feeding the worker pool
+typedef struct {
+    thread_args_t *slots;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_t *workers;
+    int workers_started;
+    const struct aesdsocket_config *config;
+} connection_queue_t;
+
+static connection_queue_t connection_queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+};
 
 int main(int argc, char *argv[]) {
+    struct aesdsocket_config config;
     struct sockaddr_in client_addr;
     socklen_t client_addr_len;
 
     // Initialize application
-    if (initialize_application(argc, argv) < 0) {
+    if (initialize_application(argc, argv, &config) < 0) {
         return -1;
     }
 
     // Setup server socket
-    if (setup_server_socket() < 0) {
+    if (setup_server_socket(&config) < 0) {
         closelog();
         return -1;
     }
 
-    // Clean up any existing data file from previous runs (only if not using char device)
-#if !USE_AESD_CHAR_DEVICE
-    if (unlink(DATA_FILE) < 0 && errno != ENOENT) {
+    // Clean up any existing data file from previous runs (only for the file backend)
+    if (config.backend == BACKEND_FILE && unlink(config_data_path(&config)) < 0 && errno != ENOENT) {
         syslog(LOG_ERR, "Error deleting existing data file: %s", strerror(errno));
     }
-#endif
 
     // Daemonize if requested
-    if (daemon_mode && daemonize() < 0) {
+    if (config.daemon && daemonize() < 0) {
         return -1;
     }
 
-    // Create timer thread to write timestamps every 10 seconds (only if not using char device)
-#if !USE_AESD_CHAR_DEVICE
-    if (pthread_create(&timer_thread_id, NULL, timer_thread_function, NULL) != 0) {
-        syslog(LOG_ERR, "Error creating timer thread: %s", strerror(errno));
+    // Set up the in-memory log before any thread can append to it
+    if (config.backend == BACKEND_MEMORY && aesd_log_init(&memory_log) < 0) {
+        syslog(LOG_ERR, "Memory allocation failed for in-memory log");
         close(socket_fd);
         closelog();
         return -1;
     }
-    timer_thread_created = 1;
-#endif
+
+    // Create the emulated device before any thread can write to it
+    if (config.backend == BACKEND_EMU) {
+        int result = aesd_emu_open(&emu_device, config_data_path(&config), CONFIG_EMU_ENTRIES, CONFIG_EMU_DATA_SIZE);
+        if (result < 0) {
+            syslog(LOG_ERR, "Error creating emulated device: %s", strerror(-result));
+            close(socket_fd);
+            closelog();
+            return -1;
+        }
+        aesd_emu_file_open(&emu_file, &emu_device);
+    }
+
+    // Create timer thread to write timestamps every 10 seconds (only if not using char device or its emulation)
+    if (config.backend != BACKEND_CHARDEV && config.backend != BACKEND_EMU) {
+        if (spawn_thread(&timer_thread_id, timer_thread_function, &config) != 0) {
+            syslog(LOG_ERR, "Error creating timer thread: %s", strerror(errno));
+            close(socket_fd);
+            closelog();
+            return -1;
+        }
+        timer_thread_created = 1;
+    }
+
+    // Start the event loop threads when running in reactor mode
+    if (config.event_loops > 0 && start_event_loops(&config) < 0) {
+        close(socket_fd);
+        closelog();
+        return -1;
+    }
+
+    // Pre-spawn the worker pool when running in pool mode
+    if (config.workers > 0 && start_worker_pool(&config) < 0) {
+        close(socket_fd);
+        closelog();
+        return -1;
+    }
+
+    // Start the reaper that joins finished connection threads
+    if (config.event_loops == 0 && config.workers == 0) {
+        if (spawn_thread(&reaper_thread_id, reaper_thread_function, NULL) != 0) {
+            syslog(LOG_ERR, "Error creating reaper thread: %s", strerror(errno));
+            close(socket_fd);
+            closelog();
+            return -1;
+        }
+        reaper_thread_created = 1;
+    }
 
     // Main accept loop
     while (!shutdown_requested) {
@@ -108,66 +229,71 @@ int main(int argc, char *argv[]) {
             continue;
         }
 
-        // Create a new thread to handle the connection
-        pthread_t thread_id;
-        thread_args_t *thread_args = malloc(sizeof(thread_args_t));
-        if (thread_args == NULL) {
-            syslog(LOG_ERR, "Memory allocation failed for thread arguments");
-            close(connection_fd);
+        // In reactor mode hand the connection to an event loop thread
+        if (config.event_loops > 0) {
+            if (dispatch_to_event_loop(connection_fd, &client_addr) < 0) {
+                close(connection_fd);
+            }
             continue;
         }
 
-        thread_args->connection_fd = connection_fd;
-        thread_args->client_addr = client_addr;
-
-        if (pthread_create(&thread_id, NULL, handle_connection_thread, thread_args) != 0) {
-            syslog(LOG_ERR, "Error creating thread: %s", strerror(errno));
-            close(connection_fd);
-            free(thread_args);
+        // In pool mode queue the connection for the next free worker
+        if (config.workers > 0) {
+            enqueue_connection(connection_fd, &client_addr);
             continue;
         }
 
-        // Add thread to the list
-        thread_node_t *new_node = malloc(sizeof(thread_node_t));
+        // Create a new thread to handle the connection
+        thread_node_t *new_node = calloc(1, sizeof(thread_node_t));
         if (new_node == NULL) {
             syslog(LOG_ERR, "Memory allocation failed for thread list node");
-            pthread_join(thread_id, NULL);
+            close(connection_fd);
             continue;
         }
 
-        new_node->thread_id = thread_id;
-        new_node->next = NULL;
+        new_node->args.connection_fd = connection_fd;
+        new_node->args.client_addr = client_addr;
+        new_node->args.config = &config;
 
+        // Append at the tail and create the thread under the lock so the
+        // thread cannot retire itself before its node and thread_id are set
         pthread_mutex_lock(&thread_list_mutex);
-        if (thread_list_head == NULL) {
-            thread_list_head = new_node;
+        new_node->prev = thread_list_tail;
+        if (thread_list_tail != NULL) {
+            thread_list_tail->next = new_node;
         } else {
-            thread_node_t *current = thread_list_head;
-            while (current->next != NULL) {
-                current = current->next;
-            }
-            current->next = new_node;
+            thread_list_head = new_node;
+        }
+        thread_list_tail = new_node;
+
+        if (spawn_thread(&new_node->thread_id, handle_connection_thread, new_node) != 0) {
+            syslog(LOG_ERR, "Error creating thread: %s", strerror(errno));
+            unlink_thread_node(new_node);
+            pthread_mutex_unlock(&thread_list_mutex);
+            close(connection_fd);
+            free(new_node);
+            continue;
         }
         pthread_mutex_unlock(&thread_list_mutex);
     }
 
     // Join all threads
-    pthread_mutex_lock(&thread_list_mutex);
-    thread_node_t *current = thread_list_head;
-    while (current != NULL) {
-        thread_node_t *next = current->next;
-        pthread_mutex_unlock(&thread_list_mutex);
-        pthread_join(current->thread_id, NULL);
-        free(current);
-        pthread_mutex_lock(&thread_list_mutex);
-        current = next;
+    join_all_threads();
+
+    if (config.backend == BACKEND_MEMORY) {
+        aesd_log_destroy(&memory_log);
+    } else if (config.backend == BACKEND_EMU) {
+        syslog(LOG_INFO, "Wrote %lu packets to the emulated device", packets_written);
+        aesd_emu_file_release(&emu_file);
+        aesd_emu_close(&emu_device);
+    } else {
+        syslog(LOG_INFO, "Wrote %lu packets with %lu data file opens", packets_written, data_file_opens);
+        close_data_descriptors();
     }
-    thread_list_head = NULL;
-    pthread_mutex_unlock(&thread_list_mutex);
 
-    // Join timer thread
-    if (timer_thread_created) {
-        pthread_join(timer_thread_id, NULL);
+    // Delete the data file (only for the file backend)
+    if (config.backend == BACKEND_FILE && unlink(config_data_path(&config)) < 0 && errno != ENOENT) {
+        syslog(LOG_ERR, "Error deleting data file: %s", strerror(errno));
     }
 
     closelog();
@@ -180,79 +306,236 @@ void signal_handler(int sig) {
     // Set shutdown flag to stop accepting new connections
     shutdown_requested = 1;
 
-    // Close the server socket to unblock accept()
+    // Close the server socket to unblock accept(); main performs the cleanup
+    // so no locks are taken from signal context
     if (socket_fd >= 0) {
         close(socket_fd);
         socket_fd = -1;
     }
+}
 
-    // Join all threads
+/**
+ * Join connection, event loop, worker pool and timer threads
+ */
+void join_all_threads(void) {
+    // Wait for connection threads to retire, then let the reaper join them
     pthread_mutex_lock(&thread_list_mutex);
-    thread_node_t *current = thread_list_head;
-    while (current != NULL) {
-        thread_node_t *next = current->next;
-        pthread_mutex_unlock(&thread_list_mutex);
-        pthread_join(current->thread_id, NULL);
-        free(current);
-        pthread_mutex_lock(&thread_list_mutex);
-        current = next;
+    while (thread_list_head != NULL) {
+        pthread_cond_wait(&thread_list_empty_cond, &thread_list_mutex);
     }
-    thread_list_head = NULL;
+    reaper_stop = 1;
+    pthread_cond_signal(&reap_cond);
     pthread_mutex_unlock(&thread_list_mutex);
 
+    if (reaper_thread_created) {
+        pthread_join(reaper_thread_id, NULL);
+        reaper_thread_created = 0;
+        syslog(LOG_INFO, "Reaped %lu connection threads", threads_reaped);
+    }
+
+    // Join event loop threads
+    stop_event_loops();
+
+    // Join worker pool threads
+    stop_worker_pool();
+
     // Join timer thread
     if (timer_thread_created) {
         pthread_join(timer_thread_id, NULL);
+        timer_thread_created = 0;
     }
+}
 
-    // Delete the data file (only if not using char device)
-#if !USE_AESD_CHAR_DEVICE
-    if (unlink(DATA_FILE) < 0 && errno != ENOENT) {
-        syslog(LOG_ERR, "Error deleting data file: %s", strerror(errno));
+/**
+ * Create a thread with SIGINT/SIGTERM blocked so signals are delivered to main
+ */
+int spawn_thread(pthread_t *thread_id, void *(*start_routine)(void *), void *args) {
+    sigset_t block_set, old_set;
+    int result;
+
+    sigemptyset(&block_set);
+    sigaddset(&block_set, SIGINT);
+    sigaddset(&block_set, SIGTERM);
+
+    pthread_sigmask(SIG_BLOCK, &block_set, &old_set);
+    result = pthread_create(thread_id, NULL, start_routine, args);
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
+    return result;
+}
+
+/**
+ * Open the shared data file descriptors if needed; file_mutex must be held
+ */
+int open_data_descriptors_locked(const struct aesdsocket_config *config) {
+    const char *data_path = config_data_path(config);
+
+    if (data_write_fd < 0) {
+        // The char device must already exist, a data file is created on first use
+        int flags = O_WRONLY | O_APPEND | O_CLOEXEC;
+        if (config->backend == BACKEND_FILE) {
+            flags |= O_CREAT;
+        }
+        data_write_fd = open(data_path, flags, DATA_FILE_MODE);
+        if (data_write_fd < 0) {
+            syslog(LOG_ERR, "Error opening data file: %s", strerror(errno));
+            return -1;
+        }
+        data_file_opens++;
     }
-#endif
 
-    closelog();
-    exit(0);
+    if (data_read_fd < 0) {
+        data_read_fd = open(data_path, O_RDONLY | O_CLOEXEC, 0);
+        if (data_read_fd < 0) {
+            syslog(LOG_ERR, "Error opening data file for reading: %s", strerror(errno));
+            return -1;
+        }
+        data_file_opens++;
+    }
+
+    return 0;
+}
+
+/**
+ * Close the shared data file descriptors so the next use reopens them
+ */
+void close_data_descriptors(void) {
+    if (data_write_fd >= 0) {
+        close(data_write_fd);
+        data_write_fd = -1;
+    }
+    if (data_read_fd >= 0) {
+        close(data_read_fd);
+        data_read_fd = -1;
+    }
 }
 
 /**
- * Send the full contents of DATA_FILE to the client
+ * Send the full contents of the data file to the client; file_mutex must be held
  */
 int send_file_contents_to_client(int connection_fd) {
-    int read_fd = open(DATA_FILE, O_RDONLY, 0);
-    if (read_fd < 0) {
-        syslog(LOG_ERR, "Error opening data file for reading: %s", strerror(errno));
+    // Positional transfer from offset 0 leaves the shared read descriptor's position alone
+    off_t offset = 0;
+
+    if (xfer_stream_to_socket(data_read_fd, &offset, connection_fd, XFER_AUTO) < 0) {
         return -1;
     }
+    return 0;
+}
 
-    ssize_t file_bytes_read;
-    char read_buffer[BUFFER_SIZE];
-    int result = 0;
+/**
+ * Send the contents of the emulated device from pos to the client; file_mutex must be held
+ */
+static int send_emu_contents_locked(int connection_fd, long long pos) {
+    char buffer[EMU_SEND_CHUNK];
+    ssize_t copied;
 
-    while ((file_bytes_read = read(read_fd, read_buffer, BUFFER_SIZE)) > 0) {
-        if (send(connection_fd, read_buffer, file_bytes_read, 0) < 0) {
-            syslog(LOG_ERR, "Error sending data to client: %s", strerror(errno));
-            result = -1;
-            break;
+    while ((copied = aesd_emu_file_pread(&emu_file, buffer, sizeof(buffer), pos)) > 0) {
+        if (send_all(connection_fd, buffer, (size_t)copied) < 0) {
+            return -1;
+        }
+        pos += copied;
+    }
+    return copied < 0 ? -1 : 0;
+}
+
+/**
+ * Copy the contents of the emulated device from pos into a malloc'd buffer; file_mutex must be held
+ */
+static int read_emu_contents_locked(long long pos, char **data_rtn, size_t *len_rtn) {
+    size_t capacity = EMU_SEND_CHUNK;
+    size_t len = 0;
+    char *data = malloc(capacity);
+    ssize_t copied = 0;
+
+    while (data != NULL && (copied = aesd_emu_file_pread(&emu_file, data + len, capacity - len, pos + len)) > 0) {
+        len += (size_t)copied;
+        if (len == capacity) {
+            char *grown = realloc(data, capacity * 2);
+            if (grown == NULL) {
+                break;
+            }
+            data = grown;
+            capacity *= 2;
         }
     }
+    if (data == NULL || len == capacity || copied < 0) {
+        free(data);
+        return -1;
+    }
+    *data_rtn = data;
+    *len_rtn = len;
+    return 0;
+}
 
-    if (file_bytes_read < 0) {
-        syslog(LOG_ERR, "Error reading data file: %s", strerror(errno));
-        result = -1;
+/**
+ * Reply with the emulated device's contents from pos; file_mutex must be held
+ * With txq the contents are copied for the event loop to send, otherwise they are sent now
+ */
+static int reply_from_emu_locked(int connection_fd, struct txq *txq, long long pos) {
+    char *data;
+    size_t len;
+
+    if (txq == NULL) {
+        return send_emu_contents_locked(connection_fd, pos);
+    }
+    if (read_emu_contents_locked(pos, &data, &len) < 0) {
+        return -1;
     }
+    return txq_push_buffer(txq, data, len);
+}
 
-    close(read_fd);
-    return result;
+/**
+ * Reply with the data file or device contents; file_mutex must be held with the descriptors open
+ * A seek reply (from_position) continues from the read descriptor's file position, any other
+ * starts at offset 0. With txq the reply is captured for the event loop to send: a data file only
+ * grows, so its current length is enough, while the char device's contents are copied.
+ */
+static int reply_from_data_locked(const struct aesdsocket_config *config, int connection_fd, struct txq *txq,
+                                  int from_position) {
+    if (txq == NULL) {
+        if (from_position) {
+            return xfer_stream_to_socket(data_read_fd, NULL, connection_fd, XFER_AUTO) < 0 ? -1 : 0;
+        }
+        return send_file_contents_to_client(connection_fd);
+    }
+
+    if (config->backend == BACKEND_FILE && !from_position) {
+        struct stat st;
+        if (fstat(data_read_fd, &st) < 0) {
+            return -1;
+        }
+        return txq_push_file(txq, data_read_fd, (size_t)st.st_size);
+    }
+
+    off_t offset = 0;
+    char *data;
+    size_t len;
+    if (xfer_read_all(data_read_fd, from_position ? NULL : &offset, &data, &len) < 0) {
+        return -1;
+    }
+    return txq_push_buffer(txq, data, len);
 }
 
 /**
- * Check if packet is a seek command and handle it
- * Returns 1 if it was a seek command (and was handled), 0 otherwise
+ * Reply with a snapshot of the in-memory log from offset, taking ownership of the snapshot
+ * With txq the snapshot is queued for the event loop to send, otherwise it is sent now
  */
-int handle_seek_command(int *data_fd, const char *packet_buffer, size_t packet_len, int connection_fd) {
-    const char *seek_prefix = "AESDCHAR_IOCSEEKTO:";
+static int reply_from_log(int connection_fd, struct txq *txq, struct aesd_log_snapshot *snap, size_t offset) {
+    if (txq != NULL) {
+        return txq_push_log(txq, snap, offset);
+    }
+    ssize_t sent = aesd_log_send(snap, offset, connection_fd);
+    aesd_log_snapshot_release(snap);
+    return sent < 0 ? -1 : 0;
+}
+
+/**
+ * Parse an "AESDCHAR_IOCSEEKTO:X,Y" packet into seekto
+ * Returns 1 if the packet is a valid seek command, 0 otherwise
+ */
+int parse_seek_command(const char *packet_buffer, size_t packet_len, struct aesd_seekto *seekto) {
+    const char *seek_prefix = SEEK_COMMAND_PREFIX;
     size_t prefix_len = strlen(seek_prefix);
 
     /* Check if packet starts with the seek prefix */
@@ -294,51 +577,74 @@ int handle_seek_command(int *data_fd, const char *packet_buffer, size_t packet_l
         return 0;
     }
 
+    seekto->write_cmd = (uint32_t)write_cmd;
+    seekto->write_cmd_offset = (uint32_t)write_cmd_offset;
+    return 1;
+}
+
+/**
+ * Check if packet is a seek command and handle it
+ * Returns 1 if it was a seek command (and was handled), 0 otherwise
+ */
+int handle_seek_command(const struct aesdsocket_config *config, const char *packet_buffer, size_t packet_len,
+                        int connection_fd, struct txq *txq) {
+    struct aesd_seekto seekto;
+
+    if (!parse_seek_command(packet_buffer, packet_len, &seekto)) {
+        return 0;
+    }
+
+    unsigned long write_cmd = seekto.write_cmd;
+    unsigned long write_cmd_offset = seekto.write_cmd_offset;
     syslog(LOG_INFO, "Processing seek command: write_cmd=%lu, write_cmd_offset=%lu", write_cmd, write_cmd_offset);
 
-    /* Lock mutex before ioctl */
-    pthread_mutex_lock(&file_mutex);
+    /* The in-memory log resolves the seek against a snapshot without any global lock */
+    if (config->backend == BACKEND_MEMORY) {
+        struct aesd_log_snapshot snap;
+        size_t offset;
 
-    /* Ensure file descriptor is open */
-    if (*data_fd < 0) {
-        *data_fd = open(DATA_FILE, O_RDWR, 0);
-        if (*data_fd < 0) {
-            syslog(LOG_ERR, "Error opening data file for seek: %s", strerror(errno));
-            pthread_mutex_unlock(&file_mutex);
-            return 1; /* Was a seek command, even though it failed */
+        aesd_log_snapshot(&memory_log, &snap);
+        if (aesd_log_command_offset(&memory_log, &snap, seekto.write_cmd, seekto.write_cmd_offset, &offset) < 0) {
+            syslog(LOG_ERR, "Seek command out of range for in-memory log");
+            aesd_log_snapshot_release(&snap);
+        } else if (reply_from_log(connection_fd, txq, &snap, offset) < 0) {
+            syslog(LOG_ERR, "Error sending data to client: %s", strerror(errno));
         }
+        return 1;
     }
 
-    /* Prepare the seek structure */
-    struct aesd_seekto seekto;
-    seekto.write_cmd = (uint32_t)write_cmd;
-    seekto.write_cmd_offset = (uint32_t)write_cmd_offset;
-
-    /* Send ioctl command */
-    if (ioctl(*data_fd, AESDCHAR_IOCSEEKTO, &seekto) < 0) {
-        syslog(LOG_ERR, "ioctl AESDCHAR_IOCSEEKTO failed: %s", strerror(errno));
+    /* The emulated device resolves the seek like the driver's ioctl would */
+    if (config->backend == BACKEND_EMU) {
+        pthread_mutex_lock(&file_mutex);
+        if (aesd_emu_file_seekto(&emu_file, seekto.write_cmd, seekto.write_cmd_offset) < 0) {
+            syslog(LOG_ERR, "Seek command out of range for emulated device");
+        } else if (reply_from_emu_locked(connection_fd, txq, emu_file.pos) < 0) {
+            syslog(LOG_ERR, "Error sending data to client: %s", strerror(errno));
+        }
         pthread_mutex_unlock(&file_mutex);
-        return 1; /* Was a seek command, even though it failed */
+        return 1;
     }
 
-    /* Now read and send file contents using the same file descriptor */
-    ssize_t file_bytes_read;
-    char read_buffer[BUFFER_SIZE];
+    /* Lock mutex before ioctl */
+    pthread_mutex_lock(&file_mutex);
 
-    while ((file_bytes_read = read(*data_fd, read_buffer, BUFFER_SIZE)) > 0) {
-        if (send(connection_fd, read_buffer, file_bytes_read, 0) < 0) {
-            syslog(LOG_ERR, "Error sending data to client: %s", strerror(errno));
-            break;
-        }
+    /* Ensure the shared descriptors are open */
+    if (open_data_descriptors_locked(config) < 0) {
+        pthread_mutex_unlock(&file_mutex);
+        return 1; /* Was a seek command, even though it failed */
     }
 
-    if (file_bytes_read < 0) {
-        syslog(LOG_ERR, "Error reading data file after seek: %s", strerror(errno));
+    /* Send ioctl command; it moves the read descriptor's file position */
+    if (ioctl(data_read_fd, AESDCHAR_IOCSEEKTO, &seekto) < 0) {
+        syslog(LOG_ERR, "ioctl AESDCHAR_IOCSEEKTO failed: %s", strerror(errno));
+        pthread_mutex_unlock(&file_mutex);
+        return 1; /* Was a seek command, even though it failed */
     }
 
-    /* Reopen the file in append mode for future writes */
-    close(*data_fd);
-    *data_fd = open(DATA_FILE, OPEN_FLAGS, OPEN_MODE);
+    /* Now stream file contents from the seek position using the same file descriptor */
+    if (reply_from_data_locked(config, connection_fd, txq, 1) < 0) {
+        syslog(LOG_ERR, "Error sending data file after seek");
+    }
 
     pthread_mutex_unlock(&file_mutex);
 
@@ -348,38 +654,139 @@ int handle_seek_command(int *data_fd, const char *packet_buffer, size_t packet_l
 /**
  * Process a complete packet: write to file and send file contents back to client
  */
-int process_complete_packet(int *data_fd, char *packet_buffer, size_t packet_len, int connection_fd) {
-    /* Check if this is a seek command */
-    if (handle_seek_command(data_fd, packet_buffer, packet_len, connection_fd)) {
-        return 0; /* Seek command handled */
+int process_complete_packet(const struct aesdsocket_config *config, const struct iovec *packet, int iovcnt,
+                            int connection_fd, struct txq *txq) {
+    size_t packet_len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        packet_len += packet[i].iov_len;
+    }
+
+    /* Check if this is a seek command; only short packets can be, so a wrapped one is linearized */
+    if (iovcnt == 1) {
+        if (handle_seek_command(config, packet[0].iov_base, packet_len, connection_fd, txq)) {
+            return 0; /* Seek command handled */
+        }
+    } else if (packet_len <= SEEK_COMMAND_MAX_LEN) {
+        char seek_buffer[SEEK_COMMAND_MAX_LEN];
+        memcpy(seek_buffer, packet[0].iov_base, packet[0].iov_len);
+        memcpy(seek_buffer + packet[0].iov_len, packet[1].iov_base, packet[1].iov_len);
+        if (handle_seek_command(config, seek_buffer, packet_len, connection_fd, txq)) {
+            return 0; /* Seek command handled */
+        }
     }
 
     /* Regular write command */
-    // Lock mutex before writing to file
-    pthread_mutex_lock(&file_mutex);
+    return write_packets(config, packet, iovcnt, 1, connection_fd, txq, 1);
+}
 
-    // Lazy open: open the file descriptor only when needed
-    if (*data_fd < 0) {
-        *data_fd = open(DATA_FILE, OPEN_FLAGS, OPEN_MODE);
-        if (*data_fd < 0) {
-            syslog(LOG_ERR, "Error opening data file: %s", strerror(errno));
+/**
+ * Append every iovec as one command with a single AESDCHAR_IOCAPPENDV
+ * Caller must hold file_mutex with the data descriptors open
+ * Returns 0 on success, 1 if the iovecs must be written with writev instead, -1 on error
+ */
+static int append_commands_locked(const struct iovec *iov, int iovcnt) {
+    struct aesd_command commands[BATCH_MAX_IOV];
+    struct aesd_appendv appendv = {0};
+
+    if (!chardev_appendv_supported || iovcnt > BATCH_MAX_IOV || iovcnt > AESD_APPENDV_MAX_COMMANDS) {
+        return 1;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        // A line split by the receive ring wrap arrives as two iovecs, which only writev stores as one command
+        if (iov[i].iov_len == 0 || ((const char *)iov[i].iov_base)[iov[i].iov_len - 1] != '\n') {
+            return 1;
+        }
+        commands[i].data = (uintptr_t)iov[i].iov_base;
+        commands[i].size = iov[i].iov_len;
+    }
+    appendv.commands = (uintptr_t)commands;
+    appendv.count = (uint32_t)iovcnt;
+
+    // The driver appends all or nothing, so an interrupted call is simply repeated
+    while (ioctl(data_write_fd, AESDCHAR_IOCAPPENDV, &appendv) < 0) {
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == ENOTTY) {
+            syslog(LOG_INFO, "Device does not support AESDCHAR_IOCAPPENDV, batching with writev");
+            chardev_appendv_supported = 0;
+            return 1;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Append packets to the storage backend under one lock acquisition and,
+ * if reply is set, send the resulting contents back to the client (or queue them on txq)
+ * Returns 0 on success, -1 on error
+ */
+int write_packets(const struct aesdsocket_config *config, const struct iovec *iov, int iovcnt, size_t packets,
+                  int connection_fd, struct txq *txq, int reply) {
+    if (config->backend == BACKEND_MEMORY) {
+        struct aesd_log_snapshot snap;
+
+        // Short append, then reply from an immutable snapshot without holding any lock
+        if (aesd_log_appendv(&memory_log, iov, iovcnt) < 0) {
+            syslog(LOG_ERR, "Memory allocation failed appending to in-memory log");
+            return -1;
+        }
+        if (!reply) {
+            return 0;
+        }
+        aesd_log_snapshot(&memory_log, &snap);
+        if (reply_from_log(connection_fd, txq, &snap, 0) < 0) {
+            syslog(LOG_ERR, "Failed to send log contents to client");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (config->backend == BACKEND_EMU) {
+        pthread_mutex_lock(&file_mutex);
+        ssize_t written = aesd_emu_file_writev(&emu_file, iov, iovcnt);
+        if (written < 0) {
+            syslog(LOG_ERR, "Error writing to emulated device: %s", strerror((int)-written));
             pthread_mutex_unlock(&file_mutex);
             return -1;
         }
+        packets_written += packets;
+        int send_result = reply ? reply_from_emu_locked(connection_fd, txq, 0) : 0;
+        pthread_mutex_unlock(&file_mutex);
+
+        if (send_result < 0) {
+            syslog(LOG_ERR, "Failed to send emulated device contents to client");
+            return -1;
+        }
+        return 0;
     }
 
-    if (write(*data_fd, packet_buffer, packet_len) < 0) {
-        syslog(LOG_ERR, "Error writing to data file: %s", strerror(errno));
+    // Lock mutex before writing to file
+    pthread_mutex_lock(&file_mutex);
+
+    // Descriptors are opened once and reused for every packet
+    if (open_data_descriptors_locked(config) < 0) {
         pthread_mutex_unlock(&file_mutex);
         return -1;
     }
 
-    // Keep the lock while sending file contents - file is being read
-    int send_result = send_file_contents_to_client(connection_fd);
+    // A batch of lines goes to the char device in one call when it supports it
+    int result = config->backend == BACKEND_CHARDEV && iovcnt > 1 ? append_commands_locked(iov, iovcnt) : 1;
+    if (result > 0) {
+        result = writev_all(data_write_fd, iov, iovcnt);
+    }
+    if (result < 0) {
+        syslog(LOG_ERR, "Error writing to data file: %s", strerror(errno));
+        // Drop the descriptors so a recovered device is reopened on the next packet
+        close_data_descriptors();
+        pthread_mutex_unlock(&file_mutex);
+        return -1;
+    }
+    packets_written += packets;
 
-    // Reopen the file while still holding the lock
-    close(*data_fd);
-    *data_fd = open(DATA_FILE, OPEN_FLAGS, OPEN_MODE);
+    // Keep the lock while sending file contents - file is being read; an event loop only captures them
+    int send_result = reply ? reply_from_data_locked(config, connection_fd, txq, 0) : 0;
 
     // Now unlock
     pthread_mutex_unlock(&file_mutex);
@@ -389,49 +796,119 @@ int process_complete_packet(int *data_fd, char *packet_buffer, size_t packet_len
         return -1;
     }
 
-    if (*data_fd < 0) {
-        syslog(LOG_ERR, "Error reopening data file: %s", strerror(errno));
-        return -1;
+    return 0;
+}
+
+/**
+ * Check whether a packet starts with the seek command prefix
+ */
+static int packet_has_seek_prefix(const struct iovec *packet, int iovcnt) {
+    const char *prefix = SEEK_COMMAND_PREFIX;
+    size_t prefix_len = strlen(prefix);
+    size_t matched = 0;
+
+    for (int i = 0; i < iovcnt && matched < prefix_len; i++) {
+        size_t len = packet[i].iov_len;
+        if (len > prefix_len - matched) {
+            len = prefix_len - matched;
+        }
+        if (memcmp(packet[i].iov_base, prefix + matched, len) != 0) {
+            return 0;
+        }
+        matched += len;
     }
+    return matched == prefix_len;
+}
+
+/**
+ * Batch mode: append all complete packets buffered in the ring with as few
+ * writev calls as possible and send a single reply
+ * Returns 0 on success, -1 if the connection should be closed
+ */
+int process_buffered_packets_batched(const struct aesdsocket_config *config, int connection_fd, struct txq *txq,
+                                     struct rxbuf *rx) {
+    struct iovec batch[BATCH_MAX_IOV];
+    struct iovec packet[2];
+    int batch_iovcnt = 0;
+    size_t batch_packets = 0;
+    int iovcnt;
+
+    // The char device stores each iovec as its own command (see append_commands_locked), so only other
+    // backends may coalesce
+    int coalesce = config->backend != BACKEND_CHARDEV;
+
+    while ((iovcnt = rxbuf_next_line(rx, packet)) > 0) {
+        // Seek commands are ordered against the writes around them
+        if (packet_has_seek_prefix(packet, iovcnt)) {
+            if (batch_packets > 0 && write_packets(config, batch, batch_iovcnt, batch_packets, connection_fd, txq, 0) < 0) {
+                return -1;
+            }
+            batch_iovcnt = 0;
+            batch_packets = 0;
+            if (process_complete_packet(config, packet, iovcnt, connection_fd, txq) < 0) {
+                return -1;
+            }
+            continue;
+        }
 
+        for (int i = 0; i < iovcnt; i++) {
+            struct iovec *last = batch_iovcnt > 0 ? &batch[batch_iovcnt - 1] : NULL;
+
+            // Consecutive lines are adjacent in the ring, so they usually extend the last iovec
+            if (coalesce && last != NULL && (char *)last->iov_base + last->iov_len == packet[i].iov_base) {
+                last->iov_len += packet[i].iov_len;
+                continue;
+            }
+            if (batch_iovcnt == BATCH_MAX_IOV) {
+                if (write_packets(config, batch, batch_iovcnt, batch_packets, connection_fd, txq, 0) < 0) {
+                    return -1;
+                }
+                batch_iovcnt = 0;
+                batch_packets = 0;
+            }
+            batch[batch_iovcnt++] = packet[i];
+        }
+        batch_packets++;
+    }
+
+    if (batch_packets > 0) {
+        return write_packets(config, batch, batch_iovcnt, batch_packets, connection_fd, txq, 1);
+    }
     return 0;
 }
 
 /**
- * Handle incoming data on a connection
+ * Process every complete packet buffered in the receive ring
+ * Returns 0 on success, -1 if the connection should be closed
  */
-void handle_client_connection(int connection_fd, int data_fd, char **packet_buffer, size_t *packet_size) {
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
+int process_buffered_packets(const struct aesdsocket_config *config, int connection_fd, struct txq *txq,
+                             struct rxbuf *rx) {
+    struct iovec packet[2];
+    int iovcnt;
 
-    while ((bytes_read = recv(connection_fd, buffer, BUFFER_SIZE, 0)) > 0) {
-        // Expand packet buffer to accommodate new data
-        char *temp = realloc(*packet_buffer, *packet_size + bytes_read);
-        if (temp == NULL) {
-            syslog(LOG_ERR, "Memory allocation failed for packet buffer");
-            free(*packet_buffer);
-            *packet_buffer = NULL;
-            *packet_size = 0;
-            break;
-        }
-        *packet_buffer = temp;
+    if (config->batch) {
+        return process_buffered_packets_batched(config, connection_fd, txq, rx);
+    }
 
-        // Append new data to packet buffer
-        memcpy(*packet_buffer + *packet_size, buffer, bytes_read);
-        *packet_size += bytes_read;
+    // Packets are framed in place, nothing is copied or shifted
+    while ((iovcnt = rxbuf_next_line(rx, packet)) > 0) {
+        if (process_complete_packet(config, packet, iovcnt, connection_fd, txq) < 0) {
+            return -1;
+        }
+    }
 
-        // Process complete packets (terminated by newline)
-        char *newline_pos;
-        while ((newline_pos = memchr(*packet_buffer, '\n', *packet_size)) != NULL) {
-            size_t packet_len = (newline_pos - *packet_buffer) + 1;
+    return 0;
+}
 
-            if (process_complete_packet(&data_fd, *packet_buffer, packet_len, connection_fd) < 0) {
-                return;
-            }
+/**
+ * Handle incoming data on a connection
+ */
+void handle_client_connection(const struct aesdsocket_config *config, int connection_fd, struct rxbuf *rx) {
+    ssize_t bytes_read;
 
-            // Remove processed packet from buffer
-            memmove(*packet_buffer, *packet_buffer + packet_len, *packet_size - packet_len);
-            *packet_size -= packet_len;
+    while ((bytes_read = rxbuf_recv(rx, connection_fd)) > 0) {
+        if (process_buffered_packets(config, connection_fd, NULL, rx) < 0) {
+            return;
         }
     }
 
@@ -443,7 +920,7 @@ void handle_client_connection(int connection_fd, int data_fd, char **packet_buff
 /**
  * Setup the server socket
  */
-int setup_server_socket(void) {
+int setup_server_socket(const struct aesdsocket_config *config) {
     // Create socket
     socket_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (socket_fd < 0) {
@@ -463,8 +940,8 @@ int setup_server_socket(void) {
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    server_addr.sin_port = htons(PORT);
+    server_addr.sin_addr = config->listen_address;
+    server_addr.sin_port = htons(config->port);
 
     if (bind(socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         syslog(LOG_ERR, "Error binding socket: %s", strerror(errno));
@@ -473,7 +950,7 @@ int setup_server_socket(void) {
     }
 
     // Listen for connections
-    if (listen(socket_fd, BACKLOG) < 0) {
+    if (listen(socket_fd, config->backlog) < 0) {
         syslog(LOG_ERR, "Error listening on socket: %s", strerror(errno));
         close(socket_fd);
         return -1;
@@ -483,22 +960,27 @@ int setup_server_socket(void) {
 }
 
 /**
- * Initialize application: parse args, setup syslog and signal handlers
+ * Initialize application: parse args and config file, setup syslog and signal handlers
  */
-int initialize_application(int argc, char *argv[]) {
-    // Parse command line arguments
-    daemon_mode = 0;
-    if (argc > 1 && strcmp(argv[1], "-d") == 0) {
-        daemon_mode = 1;
-    }
-
+int initialize_application(int argc, char *argv[], struct aesdsocket_config *config) {
     // Initialize syslog
     openlog("aesdsocket", LOG_PID, LOG_DAEMON);
 
+    // Defaults, then the config file, then command line overrides
+    config_init_defaults(config);
+    if (config_parse_args(config, argc, argv) < 0) {
+        closelog();
+        return -1;
+    }
+    config_log(config);
+
     // Register signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
+    // A client disconnecting mid-reply must not kill the server (sendfile/splice have no MSG_NOSIGNAL)
+    signal(SIGPIPE, SIG_IGN);
+
     return 0;
 }
 
@@ -525,55 +1007,508 @@ int daemonize(void) {
 /**
  * Process a single client connection (called from thread)
  */
-void process_client_connection(struct sockaddr_in *client_addr, int connection_fd) {
-    int data_fd = -1;  /* Initialize to -1 for lazy opening */
+void process_client_connection(const struct aesdsocket_config *config, struct sockaddr_in *client_addr,
+                               int connection_fd) {
     char client_ip[INET_ADDRSTRLEN];
-    char *packet_buffer = NULL;
-    size_t packet_size = 0;
+    struct rxbuf rx;
+
+    rxbuf_init(&rx, config->rx_buffer_size, config->max_line);
 
     // Convert IP address to string and log
     inet_ntop(AF_INET, &client_addr->sin_addr, client_ip, INET_ADDRSTRLEN);
     syslog(LOG_INFO, "Accepted connection from %s", client_ip);
 
     // Handle client connection
-    handle_client_connection(connection_fd, data_fd, &packet_buffer, &packet_size);
+    handle_client_connection(config, connection_fd, &rx);
 
     // Log connection close
     syslog(LOG_INFO, "Closed connection from %s", client_ip);
 
     // Cleanup
-    if (data_fd >= 0) {
-        close(data_fd);
-    }
     close(connection_fd);
-
-    if (packet_buffer != NULL) {
-        free(packet_buffer);
-    }
+    rxbuf_free(&rx);
 }
 
 /**
  * Thread function to handle a client connection
  */
 void *handle_connection_thread(void *args) {
-    thread_args_t *thread_args = (thread_args_t *)args;
-    int connection_fd = thread_args->connection_fd;
-    struct sockaddr_in client_addr = thread_args->client_addr;
+    thread_node_t *node = (thread_node_t *)args;
+
+    process_client_connection(node->args.config, &node->args.client_addr, node->args.connection_fd);
+
+    retire_connection_thread(node);
+    return NULL;
+}
+
+/**
+ * Remove a node from the running thread list; thread_list_mutex must be held
+ */
+void unlink_thread_node(thread_node_t *node) {
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        thread_list_head = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    } else {
+        thread_list_tail = node->prev;
+    }
+    node->prev = NULL;
+    node->next = NULL;
+}
+
+/**
+ * Move the calling connection thread's node onto the reap queue
+ */
+void retire_connection_thread(thread_node_t *node) {
+    pthread_mutex_lock(&thread_list_mutex);
+
+    unlink_thread_node(node);
+    if (thread_list_head == NULL) {
+        pthread_cond_signal(&thread_list_empty_cond);
+    }
+
+    if (reap_list_tail != NULL) {
+        reap_list_tail->next = node;
+    } else {
+        reap_list_head = node;
+    }
+    reap_list_tail = node;
+    pthread_cond_signal(&reap_cond);
+
+    pthread_mutex_unlock(&thread_list_mutex);
+}
+
+/**
+ * Reaper thread function - joins and frees retired connection threads
+ */
+void *reaper_thread_function(void *args) {
+    (void)args;
+
+    pthread_mutex_lock(&thread_list_mutex);
+    for (;;) {
+        while (reap_list_head == NULL && !reaper_stop) {
+            pthread_cond_wait(&reap_cond, &thread_list_mutex);
+        }
+
+        // Take the whole batch and join outside the lock
+        thread_node_t *batch = reap_list_head;
+        reap_list_head = NULL;
+        reap_list_tail = NULL;
+        if (batch == NULL) {
+            break; /* Stop requested and nothing left to reap */
+        }
+        pthread_mutex_unlock(&thread_list_mutex);
+
+        while (batch != NULL) {
+            thread_node_t *next = batch->next;
+            pthread_join(batch->thread_id, NULL);
+            free(batch);
+            threads_reaped++;
+            batch = next;
+        }
+
+        pthread_mutex_lock(&thread_list_mutex);
+    }
+    pthread_mutex_unlock(&thread_list_mutex);
+
+    return NULL;
+}
+
+/**
+ * Create the event loop threads used in reactor mode
+ */
+int start_event_loops(const struct aesdsocket_config *config) {
+    int count = config->event_loops;
+
+    event_loops = calloc(count, sizeof(event_loop_t));
+    if (event_loops == NULL) {
+        syslog(LOG_ERR, "Memory allocation failed for event loops");
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        event_loop_t *loop = &event_loops[i];
+
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epoll_fd < 0) {
+            syslog(LOG_ERR, "Error creating epoll instance: %s", strerror(errno));
+            // The loops already running only exit once shutdown is requested
+            shutdown_requested = 1;
+            stop_event_loops();
+            return -1;
+        }
+        pthread_mutex_init(&loop->lock, NULL);
+        loop->config = config;
+
+        if (spawn_thread(&loop->thread_id, event_loop_thread, loop) != 0) {
+            syslog(LOG_ERR, "Error creating event loop thread: %s", strerror(errno));
+            // This loop is not counted in event_loops_started, so stop_event_loops() leaves it alone
+            close(loop->epoll_fd);
+            pthread_mutex_destroy(&loop->lock);
+            shutdown_requested = 1;
+            stop_event_loops();
+            return -1;
+        }
+        event_loops_started++;
+    }
+
+    syslog(LOG_INFO, "Started %d event loop threads", count);
+    return 0;
+}
+
+/**
+ * Stop and join the event loop threads, closing any remaining connections
+ */
+void stop_event_loops(void) {
+    if (event_loops == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < event_loops_started; i++) {
+        event_loop_t *loop = &event_loops[i];
+
+        // Event loops poll shutdown_requested after each epoll_wait timeout
+        pthread_join(loop->thread_id, NULL);
+        close(loop->epoll_fd);
+        pthread_mutex_destroy(&loop->lock);
+    }
+
+    free(event_loops);
+    event_loops = NULL;
+    event_loops_started = 0;
+}
+
+/**
+ * Register an accepted connection with the next event loop (round robin)
+ */
+int dispatch_to_event_loop(int connection_fd, struct sockaddr_in *client_addr) {
+    event_loop_t *loop = &event_loops[next_event_loop++ % event_loops_started];
+
+    int flags = fcntl(connection_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(connection_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        syslog(LOG_ERR, "Error setting connection non-blocking: %s", strerror(errno));
+        return -1;
+    }
+
+    connection_t *conn = calloc(1, sizeof(connection_t));
+    if (conn == NULL) {
+        syslog(LOG_ERR, "Memory allocation failed for connection");
+        return -1;
+    }
+    conn->connection_fd = connection_fd;
+    rxbuf_init(&conn->rx, loop->config->rx_buffer_size, loop->config->max_line);
+    txq_init(&conn->txq);
+    inet_ntop(AF_INET, &client_addr->sin_addr, conn->client_ip, INET_ADDRSTRLEN);
+    syslog(LOG_INFO, "Accepted connection from %s", conn->client_ip);
+
+    // Link the connection before arming it so the loop can always unlink it
+    pthread_mutex_lock(&loop->lock);
+    conn->next = loop->connections;
+    if (loop->connections != NULL) {
+        loop->connections->prev = conn;
+    }
+    loop->connections = conn;
+    pthread_mutex_unlock(&loop->lock);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = conn;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, connection_fd, &event) < 0) {
+        syslog(LOG_ERR, "Error adding connection to epoll: %s", strerror(errno));
+        pthread_mutex_lock(&loop->lock);
+        if (conn->prev != NULL) {
+            conn->prev->next = conn->next;
+        } else {
+            loop->connections = conn->next;
+        }
+        if (conn->next != NULL) {
+            conn->next->prev = conn->prev;
+        }
+        pthread_mutex_unlock(&loop->lock);
+        free(conn);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Unlink a connection from its event loop and release its resources
+ */
+static void close_event_loop_connection(event_loop_t *loop, connection_t *conn) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, conn->connection_fd, NULL);
+
+    pthread_mutex_lock(&loop->lock);
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        loop->connections = conn->next;
+    }
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+    pthread_mutex_unlock(&loop->lock);
+
+    syslog(LOG_INFO, "Closed connection from %s", conn->client_ip);
+
+    close(conn->connection_fd);
+    rxbuf_free(&conn->rx);
+    txq_free(&conn->txq);
+    free(conn);
+}
+
+/**
+ * Switch a connection between waiting for input and waiting for its replies to drain
+ */
+static int set_event_loop_interest(event_loop_t *loop, connection_t *conn, int want_output) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    // Hangups and errors are always reported, so a stuck client is still noticed while output waits
+    event.events = want_output ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = conn;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, conn->connection_fd, &event) < 0) {
+        syslog(LOG_ERR, "Error updating connection events: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Send queued replies; while the socket is full, stop reading so the client is throttled
+ * Returns 0 while the connection stays open, -1 when it should be closed
+ */
+static int flush_event_loop_connection(event_loop_t *loop, connection_t *conn, int waiting) {
+    int flushed = txq_flush(&conn->txq, conn->connection_fd);
+    if (flushed < 0) {
+        syslog(LOG_ERR, "Error sending data to client: %s", strerror(errno));
+        return -1;
+    }
+    if (flushed == 0) {
+        return waiting ? 0 : set_event_loop_interest(loop, conn, 1);
+    }
+    return waiting ? set_event_loop_interest(loop, conn, 0) : 0;
+}
+
+/**
+ * Drain readable data from a non-blocking connection, or queued replies once it is writable
+ * Replies are captured while packets are processed and sent here without holding file_mutex,
+ * so a client that stops reading only stalls its own connection.
+ * Returns 0 while the connection stays open, -1 when it should be closed
+ */
+static int service_event_loop_connection(event_loop_t *loop, connection_t *conn) {
+    if (txq_pending(&conn->txq)) {
+        return flush_event_loop_connection(loop, conn, 1);
+    }
+
+    // Bound the reads per wakeup so one busy client cannot starve the others
+    for (int reads = 0; reads < EVENT_LOOP_READ_BUDGET; reads++) {
+        ssize_t bytes_read = rxbuf_recv(&conn->rx, conn->connection_fd);
+        if (bytes_read > 0) {
+            if (process_buffered_packets(loop->config, conn->connection_fd, &conn->txq, &conn->rx) < 0) {
+                return -1;
+            }
+            if (txq_pending(&conn->txq)) {
+                if (flush_event_loop_connection(loop, conn, 0) < 0) {
+                    return -1;
+                }
+                if (txq_pending(&conn->txq)) {
+                    return 0; /* Read again once the client has taken its replies */
+                }
+            }
+            continue;
+        }
+        if (bytes_read == 0) {
+            return -1; /* Client closed the connection, every reply was already sent */
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        syslog(LOG_ERR, "Error receiving data: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Event loop thread function - multiplexes its connections with epoll
+ */
+void *event_loop_thread(void *args) {
+    event_loop_t *loop = (event_loop_t *)args;
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    while (!shutdown_requested) {
+        int ready = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, EVENT_LOOP_TIMEOUT_MS);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syslog(LOG_ERR, "Error waiting for events: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            connection_t *conn = (connection_t *)events[i].data.ptr;
+
+            // Hangups and errors surface as recv() returning 0 or failing
+            if (service_event_loop_connection(loop, conn) < 0) {
+                close_event_loop_connection(loop, conn);
+            }
+        }
+    }
+
+    // Close whatever is still connected to this loop
+    while (loop->connections != NULL) {
+        close_event_loop_connection(loop, loop->connections);
+    }
+
+    return NULL;
+}
+
+/**
+ * Pre-spawn the worker pool and allocate its bounded connection queue
+ */
+int start_worker_pool(const struct aesdsocket_config *config) {
+    int workers = config->workers;
+    size_t depth = config->queue_depth;
+
+    connection_queue.config = config;
+    connection_queue.slots = calloc(depth, sizeof(thread_args_t));
+    connection_queue.workers = calloc(workers, sizeof(pthread_t));
+    if (connection_queue.slots == NULL || connection_queue.workers == NULL) {
+        syslog(LOG_ERR, "Memory allocation failed for worker pool");
+        stop_worker_pool();
+        return -1;
+    }
+    connection_queue.capacity = depth;
+
+    for (int i = 0; i < workers; i++) {
+        if (spawn_thread(&connection_queue.workers[i], worker_thread_function, &connection_queue) != 0) {
+            syslog(LOG_ERR, "Error creating worker thread: %s", strerror(errno));
+            shutdown_requested = 1;
+            stop_worker_pool();
+            return -1;
+        }
+        connection_queue.workers_started++;
+    }
+
+    syslog(LOG_INFO, "Started %d worker threads with queue depth %zu", workers, depth);
+    return 0;
+}
 
-    free(thread_args);
+/**
+ * Wake and join the worker pool, closing connections still waiting in the queue
+ */
+void stop_worker_pool(void) {
+    pthread_mutex_lock(&connection_queue.lock);
+    pthread_cond_broadcast(&connection_queue.not_empty);
+    pthread_cond_broadcast(&connection_queue.not_full);
+    pthread_mutex_unlock(&connection_queue.lock);
+
+    for (int i = 0; i < connection_queue.workers_started; i++) {
+        pthread_join(connection_queue.workers[i], NULL);
+    }
 
-    process_client_connection(&client_addr, connection_fd);
+    while (connection_queue.count > 0) {
+        close(connection_queue.slots[connection_queue.head].connection_fd);
+        connection_queue.head = (connection_queue.head + 1) % connection_queue.capacity;
+        connection_queue.count--;
+    }
+
+    free(connection_queue.workers);
+    free(connection_queue.slots);
+    connection_queue.workers = NULL;
+    connection_queue.slots = NULL;
+    connection_queue.workers_started = 0;
+    connection_queue.capacity = 0;
+    connection_queue.head = 0;
+}
+
+/**
+ * Queue an accepted connection for the worker pool, applying backpressure when full
+ * Returns 0 if queued, -1 if the connection was rejected and closed
+ */
+int enqueue_connection(int connection_fd, struct sockaddr_in *client_addr) {
+    pthread_mutex_lock(&connection_queue.lock);
+
+    while (connection_queue.count == connection_queue.capacity && !shutdown_requested) {
+        if (connection_queue.config->reject_when_full) {
+            pthread_mutex_unlock(&connection_queue.lock);
+
+            // Reset instead of a graceful close so rejected clients cost no TIME_WAIT
+            struct linger reset = { .l_onoff = 1, .l_linger = 0 };
+            setsockopt(connection_fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+            close(connection_fd);
+            syslog(LOG_WARNING, "Connection queue full, rejected client");
+            return -1;
+        }
+
+        // Timed wait so a shutdown signal is noticed without a broadcast
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += QUEUE_WAIT_TIMEOUT_SEC;
+        pthread_cond_timedwait(&connection_queue.not_full, &connection_queue.lock, &deadline);
+    }
+
+    if (shutdown_requested) {
+        pthread_mutex_unlock(&connection_queue.lock);
+        close(connection_fd);
+        return -1;
+    }
+
+    size_t tail = (connection_queue.head + connection_queue.count) % connection_queue.capacity;
+    connection_queue.slots[tail].connection_fd = connection_fd;
+    connection_queue.slots[tail].client_addr = *client_addr;
+    connection_queue.count++;
+
+    pthread_cond_signal(&connection_queue.not_empty);
+    pthread_mutex_unlock(&connection_queue.lock);
+    return 0;
+}
+
+/**
+ * Worker thread function - serves queued connections until shutdown
+ */
+void *worker_thread_function(void *args) {
+    connection_queue_t *queue = (connection_queue_t *)args;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->count == 0 && !shutdown_requested) {
+            pthread_cond_wait(&queue->not_empty, &queue->lock);
+        }
+        if (shutdown_requested) {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+
+        thread_args_t job = queue->slots[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+
+        pthread_cond_signal(&queue->not_full);
+        pthread_mutex_unlock(&queue->lock);
+
+        process_client_connection(queue->config, &job.client_addr, job.connection_fd);
+    }
 
     return NULL;
 }
+
 /**
  * Write a timestamp to the data file
  */
-void write_timestamp_to_file(void) {
+void write_timestamp_to_file(const struct aesdsocket_config *config) {
     time_t now;
     struct tm *timeinfo;
     char timestamp_str[100];
-    int data_fd;
 
     time(&now);
     timeinfo = localtime(&now);
@@ -581,21 +1516,25 @@ void write_timestamp_to_file(void) {
     // Format: timestamp:YYYYMMDDHHMMSS\n
     strftime(timestamp_str, sizeof(timestamp_str), "timestamp:%Y%m%d%H%M%S\n", timeinfo);
 
+    if (config->backend == BACKEND_MEMORY) {
+        if (aesd_log_append(&memory_log, timestamp_str, strlen(timestamp_str)) < 0) {
+            syslog(LOG_ERR, "Error writing timestamp to in-memory log");
+        }
+        return;
+    }
+
     // Lock mutex for atomic write
     pthread_mutex_lock(&file_mutex);
 
-    data_fd = open(DATA_FILE, OPEN_FLAGS, OPEN_MODE);
-    if (data_fd < 0) {
-        syslog(LOG_ERR, "Error opening data file for timestamp: %s", strerror(errno));
+    if (open_data_descriptors_locked(config) < 0) {
         pthread_mutex_unlock(&file_mutex);
         return;
     }
 
-    if (write(data_fd, timestamp_str, strlen(timestamp_str)) < 0) {
+    if (write(data_write_fd, timestamp_str, strlen(timestamp_str)) < 0) {
         syslog(LOG_ERR, "Error writing timestamp to data file: %s", strerror(errno));
     }
 
-    close(data_fd);
     pthread_mutex_unlock(&file_mutex);
 }
 
@@ -603,7 +1542,7 @@ void write_timestamp_to_file(void) {
  * Timer thread function - writes timestamp every 10 seconds
  */
 void *timer_thread_function(void *args) {
-    (void)args;
+    const struct aesdsocket_config *config = (const struct aesdsocket_config *)args;
     int elapsed = 0;
 
     while (!shutdown_requested) {
@@ -613,7 +1552,7 @@ void *timer_thread_function(void *args) {
 
         // Write timestamp every 10 seconds
         if (elapsed >= TIMESTAMP_INTERVAL && !shutdown_requested) {
-            write_timestamp_to_file();
+            write_timestamp_to_file(config);
             elapsed = 0;
         }
     }
@@ -3,6 +3,14 @@
 
 #include <stddef.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+struct thread_node;
+struct aesd_seekto;
+struct aesdsocket_config;
+struct rxbuf;
+struct txq;
 
 /**
  * Signal handler for SIGINT and SIGTERM
@@ -10,35 +18,87 @@
 void signal_handler(int sig);
 
 /**
- * Send the full contents of DATA_FILE to the client
+ * Join connection, event loop, worker pool and timer threads
+ */
+void join_all_threads(void);
+
+/**
+ * Create a thread with SIGINT/SIGTERM blocked so signals are delivered to main
+ */
+int spawn_thread(pthread_t *thread_id, void *(*start_routine)(void *), void *args);
+
+/**
+ * Open the shared data file descriptors if needed; file_mutex must be held
+ */
+int open_data_descriptors_locked(const struct aesdsocket_config *config);
+
+/**
+ * Close the shared data file descriptors so the next use reopens them
+ */
+void close_data_descriptors(void);
+
+/**
+ * Send the full contents of the data file to the client; file_mutex must be held
  */
 int send_file_contents_to_client(int connection_fd);
 
+/**
+ * Parse an "AESDCHAR_IOCSEEKTO:X,Y" packet into seekto
+ * Returns 1 if the packet is a valid seek command, 0 otherwise
+ */
+int parse_seek_command(const char *packet_buffer, size_t packet_len, struct aesd_seekto *seekto);
+
 /**
  * Check if packet is a seek command and handle it
+ * Replies go to txq when one is given (event loops), otherwise straight to connection_fd
  * Returns 1 if it was a seek command (and was handled), 0 otherwise
  */
-int handle_seek_command(int *data_fd, const char *packet_buffer, size_t packet_len, int connection_fd);
+int handle_seek_command(const struct aesdsocket_config *config, const char *packet_buffer, size_t packet_len,
+                        int connection_fd, struct txq *txq);
 
 /**
  * Process a complete packet: write to file and send file contents back to client
  */
-int process_complete_packet(int *data_fd, char *packet_buffer, size_t packet_len, int connection_fd);
+int process_complete_packet(const struct aesdsocket_config *config, const struct iovec *packet, int iovcnt,
+                            int connection_fd, struct txq *txq);
+
+/**
+ * Append packets to the storage backend under one lock acquisition and,
+ * if reply is set, send the resulting contents back to the client (or queue them on txq)
+ * Returns 0 on success, -1 on error
+ */
+int write_packets(const struct aesdsocket_config *config, const struct iovec *iov, int iovcnt, size_t packets,
+                  int connection_fd, struct txq *txq, int reply);
+
+/**
+ * Batch mode: append all complete packets buffered in the ring with as few
+ * writev calls as possible and send a single reply
+ * Returns 0 on success, -1 if the connection should be closed
+ */
+int process_buffered_packets_batched(const struct aesdsocket_config *config, int connection_fd, struct txq *txq,
+                                     struct rxbuf *rx);
+
+/**
+ * Process every complete packet buffered in the receive ring
+ * Returns 0 on success, -1 if the connection should be closed
+ */
+int process_buffered_packets(const struct aesdsocket_config *config, int connection_fd, struct txq *txq,
+                             struct rxbuf *rx);
 
 /**
  * Handle incoming data on a connection
  */
-void handle_client_connection(int connection_fd, int data_fd, char **packet_buffer, size_t *packet_size);
+void handle_client_connection(const struct aesdsocket_config *config, int connection_fd, struct rxbuf *rx);
 
 /**
  * Setup the server socket
  */
-int setup_server_socket(void);
+int setup_server_socket(const struct aesdsocket_config *config);
 
 /**
- * Initialize application: parse args, setup syslog and signal handlers
+ * Initialize application: parse args and config file, setup syslog and signal handlers
  */
-int initialize_application(int argc, char *argv[]);
+int initialize_application(int argc, char *argv[], struct aesdsocket_config *config);
 
 /**
  * Daemonize the process
@@ -48,21 +108,78 @@ int daemonize(void);
 /**
  * Process a single client connection
  */
-void process_client_connection(struct sockaddr_in *client_addr, int connection_fd);
+void process_client_connection(const struct aesdsocket_config *config, struct sockaddr_in *client_addr,
+                               int connection_fd);
 
 /**
  * Thread function to handle a client connection
  */
 void *handle_connection_thread(void *args);
 
+/**
+ * Move the calling connection thread's node onto the reap queue
+ */
+void retire_connection_thread(struct thread_node *node);
+
+/**
+ * Remove a node from the running thread list; thread_list_mutex must be held
+ */
+void unlink_thread_node(struct thread_node *node);
+
+/**
+ * Reaper thread function - joins and frees retired connection threads
+ */
+void *reaper_thread_function(void *args);
+
 /**
  * Write a timestamp to the data file
  */
-void write_timestamp_to_file(void);
+void write_timestamp_to_file(const struct aesdsocket_config *config);
 
 /**
  * Timer thread function - writes timestamp every 10 seconds
  */
 void *timer_thread_function(void *args);
 
+/**
+ * Create the event loop threads used in reactor mode
+ */
+int start_event_loops(const struct aesdsocket_config *config);
+
+/**
+ * Stop and join the event loop threads, closing any remaining connections
+ */
+void stop_event_loops(void);
+
+/**
+ * Register an accepted connection with the next event loop (round robin)
+ */
+int dispatch_to_event_loop(int connection_fd, struct sockaddr_in *client_addr);
+
+/**
+ * Event loop thread function - multiplexes its connections with epoll
+ */
+void *event_loop_thread(void *args);
+
+/**
+ * Pre-spawn the worker pool and allocate its bounded connection queue
+ */
+int start_worker_pool(const struct aesdsocket_config *config);
+
+/**
+ * Wake and join the worker pool, closing connections still waiting in the queue
+ */
+void stop_worker_pool(void);
+
+/**
+ * Queue an accepted connection for the worker pool, applying backpressure when full
+ * Returns 0 if queued, -1 if the connection was rejected and closed
+ */
+int enqueue_connection(int connection_fd, struct sockaddr_in *client_addr);
+
+/**
+ * Worker thread function - serves queued connections until shutdown
+ */
+void *worker_thread_function(void *args);
+
 #endif /* D0BAD0DB_4B5D_4015_AF61_4468F016EF65 */
@@ -0,0 +1,137 @@
+/**
+ * scan-bench: compare newline scanners used for packet framing
+ *
+ * Frames a buffer of newline terminated lines of 64 B, 1 KiB and 64 KiB with
+ * memchr() per line and with each aesd_scan_newlines implementation, and
+ * reports throughput in MiB/s.
+ *
+ * Usage: scan-bench [-s size_kib] [-i iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aesd-scan.h"
+
+#define SCAN_BENCH_BATCH 64
+
+typedef size_t (*scan_fn)(const char *, size_t, size_t *, size_t, size_t *);
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Baseline: one memchr() call per line, as the framing loop used to do
+ */
+static size_t count_lines_memchr(const char *buf, size_t len) {
+    size_t lines = 0;
+    const char *pos = buf;
+    const char *end = buf + len;
+    const char *newline;
+
+    while ((newline = memchr(pos, '\n', end - pos)) != NULL) {
+        lines++;
+        pos = newline + 1;
+    }
+    return lines;
+}
+
+static size_t count_lines_scan(scan_fn scan, const char *buf, size_t len) {
+    size_t offsets[SCAN_BENCH_BATCH];
+    size_t lines = 0;
+    size_t pos = 0;
+
+    while (pos < len) {
+        size_t scanned;
+        lines += scan(buf + pos, len - pos, offsets, SCAN_BENCH_BATCH, &scanned);
+        pos += scanned;
+    }
+    return lines;
+}
+
+int main(int argc, char *argv[]) {
+    static const size_t line_sizes[] = { 64, 1024, 64 * 1024 };
+    static const struct {
+        scan_fn fn;
+        const char *name;
+    } scanners[] = {
+        { NULL, "memchr" },
+        { aesd_scan_newlines_swar, "swar" },
+#ifdef AESD_SCAN_HAVE_X86_SIMD
+        { aesd_scan_newlines_sse2, "sse2" },
+        { aesd_scan_newlines_avx2, "avx2" },
+#endif
+    };
+    size_t size_kib = 4 * 1024;
+    int iterations = 50;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:i:")) != -1) {
+        switch (opt) {
+            case 's':
+                size_kib = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s size_kib] [-i iterations]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (size_kib < 64 || iterations <= 0) {
+        fprintf(stderr, "Size must be at least 64 KiB and iterations positive\n");
+        return 1;
+    }
+
+    size_t len = size_kib * 1024;
+    char *buf = malloc(len);
+    if (buf == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    printf("# buffer=%zu iterations=%d\n", len, iterations);
+    printf("%-10s %-8s %10s\n", "line", "scanner", "MiB/s");
+
+    for (size_t l = 0; l < sizeof(line_sizes) / sizeof(line_sizes[0]); l++) {
+        size_t expected = len / line_sizes[l];
+
+        memset(buf, 'a', len);
+        for (size_t i = 1; i <= expected; i++) {
+            buf[i * line_sizes[l] - 1] = '\n';
+        }
+
+        for (size_t s = 0; s < sizeof(scanners) / sizeof(scanners[0]); s++) {
+#ifdef AESD_SCAN_HAVE_X86_SIMD
+            if (scanners[s].fn == aesd_scan_newlines_avx2) {
+                __builtin_cpu_init();
+                if (!__builtin_cpu_supports("avx2")) {
+                    continue;
+                }
+            }
+#endif
+            double start = now_seconds();
+            for (int i = 0; i < iterations; i++) {
+                size_t lines = scanners[s].fn == NULL ? count_lines_memchr(buf, len)
+                                                      : count_lines_scan(scanners[s].fn, buf, len);
+                if (lines != expected) {
+                    fprintf(stderr, "%s: found %zu lines, expected %zu\n", scanners[s].name, lines, expected);
+                    return 1;
+                }
+            }
+            double elapsed = now_seconds() - start;
+
+            printf("%-10zu %-8s %10.1f\n", line_sizes[l], scanners[s].name,
+                   (double)len * iterations / elapsed / (1024.0 * 1024.0));
+        }
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * sendfile-bench: compare file-to-socket transfer strategies used by aesdsocket
+ *
+ * Streams a temporary file of the requested size over a loopback TCP
+ * connection with each xfer_mode and reports throughput in bytes/sec.
+ *
+ * Usage: sendfile-bench [-s size_kib] [-i iterations]
+ */
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "aesdsocket-xfer.h"
+
+struct receiver {
+    int fd;
+    atomic_size_t received;
+};
+
+static void *receiver_thread(void *args) {
+    struct receiver *rx = (struct receiver *)args;
+    static char sink[256 * 1024];
+    ssize_t n;
+
+    while ((n = recv(rx->fd, sink, sizeof(sink), 0)) > 0) {
+        atomic_fetch_add(&rx->received, (size_t)n);
+    }
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_loopback(int *client_fd, int *server_fd) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listen_fd < 0 ||
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, 1) < 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        perror("listen");
+        return -1;
+    }
+
+    *client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (*client_fd < 0 || connect(*client_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return -1;
+    }
+    *server_fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    return *server_fd < 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    static const struct {
+        enum xfer_mode mode;
+        const char *name;
+    } modes[] = {
+        { XFER_COPY, "read/send" },
+        { XFER_SENDFILE, "sendfile" },
+        { XFER_SPLICE, "splice" },
+    };
+    size_t size_kib = 16 * 1024;
+    int iterations = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:i:")) != -1) {
+        switch (opt) {
+            case 's':
+                size_kib = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s size_kib] [-i iterations]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (size_kib == 0 || iterations <= 0) {
+        fprintf(stderr, "Size and iterations must be positive\n");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // Build the source file once so every mode reads from a warm page cache
+    char path[] = "/tmp/sendfile-bench.XXXXXX";
+    int file_fd = mkstemp(path);
+    if (file_fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+
+    char line[1024];
+    memset(line, 'a', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\n';
+    for (size_t i = 0; i < size_kib; i++) {
+        if (write(file_fd, line, sizeof(line)) != (ssize_t)sizeof(line)) {
+            perror("write");
+            return 1;
+        }
+    }
+    size_t file_size = size_kib * 1024;
+
+    printf("# file_size=%zu iterations=%d\n", file_size, iterations);
+    printf("%-10s %14s %10s\n", "mode", "bytes/sec", "MiB/s");
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        int client_fd, server_fd;
+        struct receiver rx;
+        pthread_t rx_thread;
+
+        if (connect_loopback(&client_fd, &server_fd) < 0) {
+            return 1;
+        }
+        rx.fd = client_fd;
+        atomic_init(&rx.received, 0);
+        pthread_create(&rx_thread, NULL, receiver_thread, &rx);
+
+        double start = now_seconds();
+        for (int i = 0; i < iterations; i++) {
+            off_t offset = 0;
+            if (xfer_stream_to_socket(file_fd, &offset, server_fd, modes[m].mode) != (ssize_t)file_size) {
+                fprintf(stderr, "%s: transfer failed\n", modes[m].name);
+                return 1;
+            }
+        }
+        while (atomic_load(&rx.received) < file_size * iterations) {
+            sched_yield();
+        }
+        double elapsed = now_seconds() - start;
+
+        close(server_fd);
+        pthread_join(rx_thread, NULL);
+        close(client_fd);
+
+        double rate = (double)file_size * iterations / elapsed;
+        printf("%-10s %14.0f %10.1f\n", modes[m].name, rate, rate / (1024.0 * 1024.0));
+    }
+
+    close(file_fd);
+    return 0;
+}
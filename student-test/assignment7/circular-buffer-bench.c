@@ -0,0 +1,263 @@
+/**
+ * circular-buffer-bench: throughput and latency of the aesd-circular-buffer hot path
+ *
+ * For each history depth and entry size, measures aesd_circular_buffer_add_entry() on a full
+ * buffer (every add evicts the oldest entry) and aesd_circular_buffer_find_entry_offset_for_fpos()
+ * with sequential, uniformly random and tail-heavy positions. Tail-heavy lookups land in the
+ * newest eighth of the stream nine times out of ten, like readers following new writes.
+ *
+ * Latencies are sampled over groups of AESD_BENCH_GROUP operations so clock overhead does not
+ * dominate; percentiles are per operation. Results are written as CSV, one row per case, with
+ * "#" comment lines describing the run.
+ *
+ * Usage: circular-buffer-bench [-n ops] [-s seed] [-o output.csv]
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aesd-circular-buffer.h"
+
+#define AESD_BENCH_GROUP 16
+
+enum bench_pattern {
+    PATTERN_SEQUENTIAL,
+    PATTERN_RANDOM,
+    PATTERN_TAIL,
+};
+
+static const char *const pattern_names[] = { "sequential", "random", "tail" };
+
+struct bench_result {
+    double ns_per_op;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+static uint64_t rng_state;
+
+/**
+ * xorshift64*, fast enough to keep out of the way and reproducible across runs for a seed
+ */
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Turn the per-group samples of a run of ops operations into a result; sorts samples
+ */
+static void summarize(uint64_t *samples, size_t groups, size_t ops, uint64_t total_ns,
+                      struct bench_result *result) {
+    qsort(samples, groups, sizeof(*samples), compare_u64);
+    result->ns_per_op = (double)total_ns / ops;
+    result->p50 = (double)samples[groups * 50 / 100] / AESD_BENCH_GROUP;
+    result->p90 = (double)samples[groups * 90 / 100] / AESD_BENCH_GROUP;
+    result->p99 = (double)samples[groups * 99 / 100] / AESD_BENCH_GROUP;
+    result->max = (double)samples[groups - 1] / AESD_BENCH_GROUP;
+}
+
+/**
+ * Fill buffer to capacity with entries of entry_size bytes pointing into data
+ */
+static void fill(struct aesd_circular_buffer *buffer, uint32_t entries, const char *data, size_t entry_size) {
+    struct aesd_buffer_entry entry = { .buffptr = data, .size = entry_size };
+
+    for (uint32_t i = 0; i < entries; i++) {
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+}
+
+static void bench_add(struct aesd_circular_buffer *buffer, const char *data, size_t entry_size,
+                      uint64_t *samples, size_t groups, struct bench_result *result) {
+    struct aesd_buffer_entry entry = { .buffptr = data, .size = entry_size };
+    uint64_t total = 0;
+
+    for (size_t g = 0; g < groups; g++) {
+        uint64_t start = now_ns();
+        for (int i = 0; i < AESD_BENCH_GROUP; i++) {
+            aesd_circular_buffer_add_entry(buffer, &entry);
+        }
+        samples[g] = now_ns() - start;
+        total += samples[g];
+    }
+    summarize(samples, groups, groups * AESD_BENCH_GROUP, total, result);
+}
+
+/**
+ * Precompute the lookup positions of a pattern so the generator stays out of the timed loop
+ */
+static void make_positions(size_t *positions, size_t count, enum bench_pattern pattern,
+                           size_t total_size, size_t entry_size) {
+    size_t tail_start = total_size - total_size / 8;
+    size_t stride = entry_size / 2 + 1;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        switch (pattern) {
+            case PATTERN_SEQUENTIAL:
+                positions[i] = pos;
+                pos = (pos + stride) % total_size;
+                break;
+            case PATTERN_RANDOM:
+                positions[i] = rng_next() % total_size;
+                break;
+            case PATTERN_TAIL:
+                if (rng_next() % 10 != 0) {
+                    positions[i] = tail_start + rng_next() % (total_size - tail_start);
+                } else {
+                    positions[i] = rng_next() % total_size;
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * Time lookups of positions; returns -1 if any lookup gives a wrong answer
+ */
+static int bench_find(struct aesd_circular_buffer *buffer, const size_t *positions, size_t entry_size,
+                      uint64_t *samples, size_t groups, struct bench_result *result) {
+    uint64_t total = 0;
+    size_t checksum = 0;
+    size_t misses = 0;
+
+    for (size_t g = 0; g < groups; g++) {
+        const size_t *group = positions + g * AESD_BENCH_GROUP;
+        uint64_t start = now_ns();
+        for (int i = 0; i < AESD_BENCH_GROUP; i++) {
+            size_t offset;
+            struct aesd_buffer_entry *entry =
+                aesd_circular_buffer_find_entry_offset_for_fpos(buffer, group[i], &offset);
+            if (entry == NULL) {
+                misses++;
+            } else {
+                checksum += offset;
+            }
+        }
+        samples[g] = now_ns() - start;
+        total += samples[g];
+    }
+
+    // Every entry has the same size, so the offset within the entry is known
+    size_t expected = 0;
+    for (size_t i = 0; i < groups * AESD_BENCH_GROUP; i++) {
+        expected += positions[i] % entry_size;
+    }
+    if (misses != 0 || checksum != expected) {
+        return -1;
+    }
+    summarize(samples, groups, groups * AESD_BENCH_GROUP, total, result);
+    return 0;
+}
+
+static void print_result(FILE *out, const char *operation, const char *pattern, uint32_t entries,
+                         size_t entry_size, size_t ops, const struct bench_result *result) {
+    fprintf(out, "%s,%s,%u,%zu,%zu,%.2f,%.0f,%.2f,%.2f,%.2f,%.2f\n", operation, pattern, entries,
+            entry_size, ops, result->ns_per_op, 1e9 / result->ns_per_op, result->p50, result->p90,
+            result->p99, result->max);
+}
+
+int main(int argc, char *argv[]) {
+    static const uint32_t entry_counts[] = { AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, 64, 1024, 65536 };
+    static const size_t entry_sizes[] = { 16, 256, 4096 };
+    size_t ops = 1 << 20;
+    uint64_t seed = 1;
+    const char *output_path = NULL;
+    FILE *out = stdout;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:o:")) != -1) {
+        switch (opt) {
+            case 'n':
+                ops = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n ops] [-s seed] [-o output.csv]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (ops < 100 * AESD_BENCH_GROUP) {
+        fprintf(stderr, "At least %d operations are needed per case\n", 100 * AESD_BENCH_GROUP);
+        return 1;
+    }
+    if (output_path != NULL && (out = fopen(output_path, "w")) == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", output_path, strerror(errno));
+        return 1;
+    }
+
+    size_t groups = ops / AESD_BENCH_GROUP;
+    ops = groups * AESD_BENCH_GROUP;
+    uint64_t *samples = malloc(groups * sizeof(*samples));
+    size_t *positions = malloc(ops * sizeof(*positions));
+    char *data = calloc(1, entry_sizes[sizeof(entry_sizes) / sizeof(entry_sizes[0]) - 1]);
+    if (samples == NULL || positions == NULL || data == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    rng_state = seed ? seed : 1;
+
+    fprintf(out, "# circular-buffer-bench ops=%zu seed=%llu group=%d\n", ops, (unsigned long long)seed,
+            AESD_BENCH_GROUP);
+    fprintf(out, "operation,pattern,entries,entry_size,ops,ns_per_op,ops_per_sec,p50_ns,p90_ns,p99_ns,max_ns\n");
+
+    for (size_t e = 0; e < sizeof(entry_counts) / sizeof(entry_counts[0]); e++) {
+        for (size_t s = 0; s < sizeof(entry_sizes) / sizeof(entry_sizes[0]); s++) {
+            struct aesd_circular_buffer buffer;
+            struct bench_result result;
+
+            if (aesd_circular_buffer_init_capacity(&buffer, entry_counts[e], 0) != 0) {
+                fprintf(stderr, "Cannot allocate a buffer of %u entries\n", entry_counts[e]);
+                return 1;
+            }
+            fill(&buffer, entry_counts[e], data, entry_sizes[s]);
+
+            bench_add(&buffer, data, entry_sizes[s], samples, groups, &result);
+            print_result(out, "add", "-", entry_counts[e], entry_sizes[s], ops, &result);
+
+            for (int p = PATTERN_SEQUENTIAL; p <= PATTERN_TAIL; p++) {
+                make_positions(positions, ops, p, aesd_circular_buffer_total_size(&buffer), entry_sizes[s]);
+                if (bench_find(&buffer, positions, entry_sizes[s], samples, groups, &result) != 0) {
+                    fprintf(stderr, "find: wrong result for %u entries of %zu bytes (%s)\n",
+                            entry_counts[e], entry_sizes[s], pattern_names[p]);
+                    return 1;
+                }
+                print_result(out, "find", pattern_names[p], entry_counts[e], entry_sizes[s], ops, &result);
+            }
+            aesd_circular_buffer_release(&buffer);
+        }
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(data);
+    free(positions);
+    free(samples);
+    return 0;
+}